@@ -21,10 +21,9 @@
 #include <string.h>
 #include <strings.h>
 
+#include "parser.h"
 #include "util.h"
 
-struct GumboInternalParser;
-
 GumboAttribute* gumbo_get_attribute(
     const GumboVector* attributes, const char* name) {
   for (int i = 0; i < attributes->length; ++i) {
@@ -42,3 +41,35 @@ void gumbo_destroy_attribute(
   gumbo_parser_deallocate(parser, (void*) attribute->value);
   gumbo_parser_deallocate(parser, (void*) attribute);
 }
+
+GumboStringPiece gumbo_attribute_value_piece(const GumboAttribute* attribute) {
+  GumboStringPiece value;
+  if (attribute->value) {
+    value.data = attribute->value;
+    value.length = strlen(attribute->value);
+    return value;
+  }
+  value = attribute->original_value;
+  if (value.data == attribute->original_name.data) {
+    // No value at all; the original text is that of the name.
+    value.length = 0;
+  } else if (value.length >= 2 && (*value.data == '"' || *value.data == '\'')) {
+    ++value.data;
+    value.length -= 2;
+  }
+  return value;
+}
+
+const char* gumbo_attribute_value(
+    const GumboOptions* options, GumboAttribute* attribute) {
+  if (!attribute->value) {
+    GumboParser parser;
+    parser._options = options;
+    GumboStringPiece value = gumbo_attribute_value_piece(attribute);
+    char* copy = gumbo_parser_allocate(&parser, value.length + 1);
+    memcpy(copy, value.data, value.length);
+    copy[value.length] = '\0';
+    attribute->value = copy;
+  }
+  return attribute->value;
+}
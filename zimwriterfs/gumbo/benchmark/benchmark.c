@@ -0,0 +1,949 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Parser benchmark and regression check over the corpus next to this file.
+//
+// Usage: gumbo_benchmark [--update] [--quick] DIRECTORY
+//
+// Every corpus/<class>/*.html file under DIRECTORY is parsed with the default
+// options, and a dump of the resulting tree is compared with
+// golden/<class>/<name>.txt; --update rewrites the dumps instead.  So are the
+// events of gumbo_tokenize, with golden/<class>/<name>.events.txt.
+//
+// The other ways of parsing are checked against the default parse:
+//   - lean: the options zimwriterfs uses (lean, zero_copy_text and
+//     lazy_attribute_values) give the same tree, positions aside;
+//   - push: feeding those one byte, then 61 bytes at a time to a push parser
+//     gives the same tree again;
+//   - flat: gumbo_flatten of the default tree walks to the same nodes;
+//   - serialize: gumbo_serialize of the lean tree reproduces the source, or
+//     golden/<class>/<name>.serialized.html for the files it can't (nodes
+//     moved by the parser).  For the others, the links are then rewritten in
+//     both trees as zimwriterfs does, and the lean one serialized and parsed
+//     back has to be the default one.
+//
+// Throughput of the default parse and of the zimwriterfs one (push parse and
+// serialize), allocations and peak heap use are then reported for each class.
+// --quick skips the timing, for a plain regression check.  The exit status is
+// nonzero if any check fails.
+
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gumbo.h"
+#include "error.h"
+
+static const char* const kClasses[] = {
+  "stubs", "large", "tables", "scripts", "malformed"
+};
+
+// Each timing loop parses about this many bytes, and the file at least
+// kMinIterations times.
+static const size_t kBytesPerTiming = 16 << 20;
+static const size_t kMinIterations = 10;
+static const size_t kMaxIterations = 100000;
+
+// Chunk sizes the push parser is fed with.
+static const size_t kPushChunkSizes[] = {1, 61};
+
+// What a dump shows.  The golden dumps have everything; the comparisons
+// between ways of parsing leave out what they differ in by design.
+enum {
+  // Line and column of positions, which lean parses don't track.
+  kDumpLineColumn = 1,
+  // Offsets and source lengths, which change when the tree is reserialized.
+  kDumpOffsets = 2,
+  // The errors, which lean parses don't record.
+  kDumpErrors = 4,
+  // How each node was inserted, which can change for the nodes the parser
+  // reconstructed when their reserialization is parsed.
+  kDumpParseFlags = 8,
+  kDumpAll = kDumpLineColumn | kDumpOffsets | kDumpErrors | kDumpParseFlags
+};
+
+// Heap statistics gathered by the counting allocator below.
+typedef struct {
+  size_t allocations;
+  size_t reallocations;
+  size_t live_bytes;
+  size_t peak_bytes;
+} HeapStats;
+
+// Blocks carry their size in front of them, so that frees can be accounted for.
+typedef union {
+  size_t size;
+  long double align_float;
+  long long align_integer;
+  void* align_pointer;
+} BlockHeader;
+
+static void* counting_allocate(void* userdata, size_t size) {
+  HeapStats* stats = userdata;
+  BlockHeader* header = malloc(sizeof(BlockHeader) + size);
+  if (!header) {
+    abort();
+  }
+  header->size = size;
+  ++stats->allocations;
+  stats->live_bytes += size;
+  if (stats->live_bytes > stats->peak_bytes) {
+    stats->peak_bytes = stats->live_bytes;
+  }
+  return header + 1;
+}
+
+static void counting_deallocate(void* userdata, void* ptr) {
+  HeapStats* stats = userdata;
+  if (!ptr) {
+    return;
+  }
+  BlockHeader* header = (BlockHeader*) ptr - 1;
+  stats->live_bytes -= header->size;
+  free(header);
+}
+
+static void* counting_reallocate(
+    void* userdata, void* ptr, size_t old_size, size_t new_size) {
+  HeapStats* stats = userdata;
+  BlockHeader* header = realloc((BlockHeader*) ptr - 1,
+                                sizeof(BlockHeader) + new_size);
+  if (!header) {
+    abort();
+  }
+  stats->live_bytes += new_size - header->size;
+  header->size = new_size;
+  ++stats->reallocations;
+  if (stats->live_bytes > stats->peak_bytes) {
+    stats->peak_bytes = stats->live_bytes;
+  }
+  (void) old_size;
+  return header + 1;
+}
+
+// A growable, NUL-terminated string.
+typedef struct {
+  char* data;
+  size_t length;
+  size_t capacity;
+} Text;
+
+static void text_reserve(Text* text, size_t length) {
+  if (text->length + length + 1 <= text->capacity) {
+    return;
+  }
+  size_t capacity = text->capacity ? text->capacity : 4096;
+  while (capacity < text->length + length + 1) {
+    capacity *= 2;
+  }
+  text->data = realloc(text->data, capacity);
+  if (!text->data) {
+    abort();
+  }
+  text->capacity = capacity;
+}
+
+static void text_append(Text* text, const char* data, size_t length) {
+  text_reserve(text, length);
+  memcpy(text->data + text->length, data, length);
+  text->length += length;
+  text->data[text->length] = '\0';
+}
+
+static void text_printf(Text* text, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  text_reserve(text, length);
+  va_start(args, format);
+  vsnprintf(text->data + text->length, length + 1, format, args);
+  va_end(args);
+  text->length += length;
+}
+
+// Appends a quoted string, with quotes, backslashes and control characters
+// escaped so that each node stays on a single line.
+static void dump_string(Text* text, const char* data, size_t length) {
+  text_append(text, "\"", 1);
+  for (size_t i = 0; i < length; ++i) {
+    unsigned char c = data[i];
+    switch (c) {
+      case '\n':
+        text_append(text, "\\n", 2);
+        break;
+      case '\r':
+        text_append(text, "\\r", 2);
+        break;
+      case '\t':
+        text_append(text, "\\t", 2);
+        break;
+      case '"':
+      case '\\':
+        text_append(text, "\\", 1);
+        text_append(text, data + i, 1);
+        break;
+      default:
+        if (c < 0x20 || c == 0x7f) {
+          text_printf(text, "\\x%02x", c);
+        } else {
+          text_append(text, data + i, 1);
+        }
+        break;
+    }
+  }
+  text_append(text, "\"", 1);
+}
+
+static void dump_position(
+    Text* text, const GumboSourcePosition* position, int flags) {
+  if (flags & kDumpLineColumn) {
+    text_printf(text, " @%u:%u:%u",
+                position->line, position->column, position->offset);
+  } else if (flags & kDumpOffsets) {
+    text_printf(text, " @%u", position->offset);
+  }
+}
+
+// The text of a text node; those of zero_copy_text parses aren't terminated.
+static GumboStringPiece text_of(const GumboText* text) {
+  GumboStringPiece piece;
+  piece.data = text->text;
+  piece.length = text->text == text->original_text.data ?
+      text->original_text.length : strlen(text->text);
+  return piece;
+}
+
+// The name of an element, as gumbo_flatten stores it for unknown tags.
+static GumboStringPiece tag_name_of(const GumboElement* element) {
+  GumboStringPiece name;
+  if (element->tag == GUMBO_TAG_UNKNOWN) {
+    name = element->original_tag;
+    gumbo_tag_from_original_text(&name);
+  } else {
+    name.data = gumbo_normalized_tagname(element->tag);
+    name.length = strlen(name.data);
+  }
+  return name;
+}
+
+static const char* namespace_prefix(GumboNamespaceEnum tag_namespace) {
+  switch (tag_namespace) {
+    case GUMBO_NAMESPACE_SVG:
+      return "svg ";
+    case GUMBO_NAMESPACE_MATHML:
+      return "math ";
+    default:
+      return "";
+  }
+}
+
+static void dump_element(Text* text, const GumboElement* element, int flags) {
+  text_printf(text, "<%s", namespace_prefix(element->tag_namespace));
+  GumboStringPiece name = tag_name_of(element);
+  text_append(text, name.data, name.length);
+  text_append(text, ">", 1);
+  dump_position(text, &element->start_pos, flags);
+  dump_position(text, &element->end_pos, flags);
+  if (flags & kDumpOffsets) {
+    text_printf(text, " tag=%u end=%u",
+                (unsigned) element->original_tag.length,
+                (unsigned) element->original_end_tag.length);
+  }
+}
+
+static void dump_attributes(
+    Text* text, const GumboElement* element, size_t depth, int flags) {
+  for (int i = 0; i < element->attributes.length; ++i) {
+    const GumboAttribute* attr = element->attributes.data[i];
+    text_printf(text, "%*s%d:%s=", (int) (depth * 2 + 2), "",
+                (int) attr->attr_namespace, attr->name);
+    GumboStringPiece value = gumbo_attribute_value_piece(attr);
+    dump_string(text, value.data, value.length);
+    dump_position(text, &attr->name_start, flags);
+    dump_position(text, &attr->value_end, flags);
+    text_append(text, "\n", 1);
+  }
+}
+
+static const GumboVector* children_of(const GumboNode* node) {
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      return &node->v.document.children;
+    case GUMBO_NODE_ELEMENT:
+      return &node->v.element.children;
+    default:
+      return NULL;
+  }
+}
+
+// Writes one line per node and attribute, indented by depth, then one per
+// error.  With kDumpAll, everything the parser decides is in there, so that two
+// dumps only compare equal for the same tree.
+static void dump_output(
+    Text* text, const GumboOutput* output, const char* buffer, int flags) {
+  static const char* const kTypes[] = {
+    "document", "element", "text", "cdata", "comment", "whitespace"
+  };
+  const GumboNode* node = output->document;
+  size_t depth = 0;
+  while (node) {
+    text_printf(text, "%*s", (int) (depth * 2), "");
+    switch (node->type) {
+      case GUMBO_NODE_DOCUMENT: {
+        const GumboDocument* document = &node->v.document;
+        text_printf(text, "#document quirks=%d", document->doc_type_quirks_mode);
+        if (document->has_doctype) {
+          text_append(text, " doctype=", 9);
+          dump_string(text, document->name, strlen(document->name));
+          dump_string(text, document->public_identifier,
+                      strlen(document->public_identifier));
+          dump_string(text, document->system_identifier,
+                      strlen(document->system_identifier));
+        }
+        break;
+      }
+      case GUMBO_NODE_ELEMENT:
+        dump_element(text, &node->v.element, flags);
+        break;
+      default: {
+        text_printf(text, "#%s ", kTypes[node->type]);
+        GumboStringPiece node_text = text_of(&node->v.text);
+        dump_string(text, node_text.data, node_text.length);
+        dump_position(text, &node->v.text.start_pos, flags);
+        if (flags & kDumpOffsets) {
+          text_printf(text, " source=%u",
+                      (unsigned) node->v.text.original_text.length);
+        }
+        break;
+      }
+    }
+    if (flags & kDumpParseFlags) {
+      text_printf(text, " flags=0x%x", (unsigned) node->parse_flags);
+    }
+    text_append(text, "\n", 1);
+    if (node->type == GUMBO_NODE_ELEMENT) {
+      dump_attributes(text, &node->v.element, depth, flags);
+    }
+
+    // On to the next node in document order.
+    const GumboVector* children = children_of(node);
+    if (children && children->length > 0) {
+      node = children->data[0];
+      ++depth;
+      continue;
+    }
+    for (; node->parent; node = node->parent, --depth) {
+      const GumboVector* siblings = children_of(node->parent);
+      if (node->index_within_parent + 1 < siblings->length) {
+        break;
+      }
+    }
+    node = node->parent ?
+        children_of(node->parent)->data[node->index_within_parent + 1] : NULL;
+  }
+
+  for (int i = 0; (flags & kDumpErrors) && i < output->errors.length; ++i) {
+    const GumboError* error = output->errors.data[i];
+    text_printf(text, "error %d @%ld\n", (int) error->type,
+                (long) (error->original_text - buffer));
+  }
+}
+
+// Appends a tag name the way the tokenizer normalizes it, as gumbo_flatten
+// pools the names of unknown elements: lowercase, NULs replaced by U+FFFD.
+static void append_tag_name(Text* text, GumboStringPiece name) {
+  for (size_t i = 0; i < name.length; ++i) {
+    char c = name.data[i];
+    if (c == '\0') {
+      text_append(text, "\xEF\xBF\xBD", 3);
+    } else {
+      c = c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+      text_append(text, &c, 1);
+    }
+  }
+}
+
+// Writes a node the way dump_flat does, from the tree.
+static void dump_tree_node(
+    Text* text, const GumboNode* node, const char* buffer, size_t depth) {
+  GumboStringPiece node_text = kGumboEmptyString;
+  GumboStringPiece source = kGumboEmptyString;
+  Text name = {NULL, 0, 0};
+  size_t source_offset = 0;
+  int tag = GUMBO_TAG_UNKNOWN;
+  int tag_namespace = GUMBO_NAMESPACE_HTML;
+  if (node->type == GUMBO_NODE_ELEMENT) {
+    const GumboElement* element = &node->v.element;
+    tag = element->tag;
+    tag_namespace = element->tag_namespace;
+    if (tag == GUMBO_TAG_UNKNOWN && element->original_tag.length > 0) {
+      append_tag_name(&name, tag_name_of(element));
+      node_text.data = name.data;
+      node_text.length = name.length;
+    }
+    source = element->original_tag;
+    source_offset = source.length > 0 ?
+        (size_t) (source.data - buffer) : element->start_pos.offset;
+  } else if (node->type != GUMBO_NODE_DOCUMENT) {
+    node_text = text_of(&node->v.text);
+    source = node->v.text.original_text;
+    source_offset = source.length > 0 ? (size_t) (source.data - buffer) : 0;
+  }
+  text_printf(text, "%*s%d %d %d ", (int) (depth * 2), "", (int) node->type,
+              tag, tag_namespace);
+  dump_string(text, node_text.data, node_text.length);
+  text_printf(text, " @%lu+%lu\n", (unsigned long) source_offset,
+              (unsigned long) source.length);
+  free(name.data);
+  if (node->type == GUMBO_NODE_ELEMENT) {
+    for (int i = 0; i < node->v.element.attributes.length; ++i) {
+      const GumboAttribute* attr = node->v.element.attributes.data[i];
+      GumboStringPiece value = gumbo_attribute_value_piece(attr);
+      text_printf(text, "%*s%s=", (int) (depth * 2 + 2), "", attr->name);
+      dump_string(text, value.data, value.length);
+      text_append(text, "\n", 1);
+    }
+  }
+}
+
+static void dump_tree(Text* text, const GumboOutput* output,
+                      const char* buffer) {
+  const GumboNode* node = output->document;
+  size_t depth = 0;
+  while (node) {
+    dump_tree_node(text, node, buffer, depth);
+    const GumboVector* children = children_of(node);
+    if (children && children->length > 0) {
+      node = children->data[0];
+      ++depth;
+      continue;
+    }
+    for (; node->parent; node = node->parent, --depth) {
+      const GumboVector* siblings = children_of(node->parent);
+      if (node->index_within_parent + 1 < siblings->length) {
+        break;
+      }
+    }
+    node = node->parent ?
+        children_of(node->parent)->data[node->index_within_parent + 1] : NULL;
+  }
+}
+
+// Writes the nodes of a flat document, following its links from the document
+// node; the walk has to meet the nodes in index order, as the tree walk does.
+static void dump_flat(Text* text, const GumboFlatDocument* document) {
+  uint32_t index = 0;
+  uint32_t expected = 0;
+  size_t depth = 0;
+  while (index != GUMBO_FLAT_NONE) {
+    if (index != expected++) {
+      text_printf(text, "node %u out of order\n", (unsigned) index);
+      return;
+    }
+    const GumboFlatNode* node = &document->nodes[index];
+    const char* node_text = document->strings + node->text;
+    text_printf(text, "%*s%d %d %d ", (int) (depth * 2), "", (int) node->type,
+                (int) node->tag, (int) node->tag_namespace);
+    dump_string(text, node_text, strlen(node_text));
+    text_printf(text, " @%lu+%lu\n", (unsigned long) node->source_offset,
+                (unsigned long) node->source_length);
+    for (uint32_t i = 0; i < node->attribute_count; ++i) {
+      const GumboFlatAttribute* attr =
+          &document->attributes[node->first_attribute + i];
+      const char* value = document->strings + attr->value;
+      text_printf(text, "%*s%s=", (int) (depth * 2 + 2), "",
+                  document->strings + attr->name);
+      dump_string(text, value, strlen(value));
+      text_append(text, "\n", 1);
+    }
+
+    if (node->first_child != GUMBO_FLAT_NONE) {
+      index = node->first_child;
+      ++depth;
+      continue;
+    }
+    while (index != GUMBO_FLAT_NONE &&
+           document->nodes[index].next_sibling == GUMBO_FLAT_NONE) {
+      index = document->nodes[index].parent;
+      --depth;
+    }
+    if (index != GUMBO_FLAT_NONE) {
+      index = document->nodes[index].next_sibling;
+    }
+  }
+  if (expected != document->node_count) {
+    text_printf(text, "%u of %lu nodes reached\n", (unsigned) expected,
+                (unsigned long) document->node_count);
+  }
+}
+
+// gumbo_tokenize callback state for dump_event.
+typedef struct {
+  Text* text;
+  const char* buffer;
+} EventDump;
+
+// Writes one line per event and per attribute.
+static bool dump_event(void* userdata, const GumboEvent* event) {
+  static const char* const kEventTypes[] = {
+    "doctype", "start", "end", "text", "comment"
+  };
+  EventDump* dump = userdata;
+  Text* text = dump->text;
+  text_printf(text, "%s %s @%ld+%lu", kEventTypes[event->type],
+              event->tag == GUMBO_TAG_UNKNOWN ?
+                  "-" : gumbo_normalized_tagname(event->tag),
+              (long) (event->original_text.data - dump->buffer),
+              (unsigned long) event->original_text.length);
+  if (event->text) {
+    text_append(text, " ", 1);
+    dump_string(text, event->text, strlen(event->text));
+  }
+  if (event->is_self_closing) {
+    text_append(text, " /", 2);
+  }
+  text_append(text, "\n", 1);
+  for (int i = 0; event->attributes && i < event->attributes->length; ++i) {
+    const GumboAttribute* attr = event->attributes->data[i];
+    GumboStringPiece value = gumbo_attribute_value_piece(attr);
+    text_printf(text, "  %s=", attr->name);
+    dump_string(text, value.data, value.length);
+    text_append(text, "\n", 1);
+  }
+  return true;
+}
+
+static bool read_file(const char* path, Text* contents) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+  char chunk[65536];
+  size_t length;
+  while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    text_append(contents, chunk, length);
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+static bool write_file(const char* path, const Text* contents) {
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+  bool ok = fwrite(contents->data, 1, contents->length, file) ==
+      contents->length;
+  return fclose(file) == 0 && ok;
+}
+
+// Reports the first line at which the dumps differ.
+static void report_difference(const char* path, const char* what,
+                              const Text* expected, const Text* actual) {
+  size_t line = 1;
+  size_t start = 0;
+  size_t i = 0;
+  for (; i < expected->length && i < actual->length; ++i) {
+    if (expected->data[i] != actual->data[i]) {
+      break;
+    }
+    if (expected->data[i] == '\n') {
+      ++line;
+      start = i + 1;
+    }
+  }
+  const char* expected_end = strchr(expected->data + start, '\n');
+  const char* actual_end = strchr(actual->data + start, '\n');
+  fprintf(stderr, "%s:%lu: %s differs\n  expected: %.*s\n  actual:   %.*s\n",
+          path, (unsigned long) line, what,
+          (int) (expected_end ? expected_end - expected->data - start :
+                 (long) (expected->length - start)),
+          expected->data + start,
+          (int) (actual_end ? actual_end - actual->data - start :
+                 (long) (actual->length - start)),
+          actual->data + start);
+}
+
+static int compare_names(const void* a, const void* b) {
+  return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Returns the sorted *.html names in a directory, NULL-terminated.
+static char** list_html_files(const char* path) {
+  DIR* dir = opendir(path);
+  if (!dir) {
+    return NULL;
+  }
+  size_t count = 0;
+  char** names = malloc(sizeof(char*));
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    size_t length = strlen(entry->d_name);
+    if (length > 5 && !strcmp(entry->d_name + length - 5, ".html")) {
+      names = realloc(names, sizeof(char*) * (count + 2));
+      names[count] = malloc(length + 1);
+      memcpy(names[count++], entry->d_name, length + 1);
+    }
+  }
+  closedir(dir);
+  qsort(names, count, sizeof(char*), compare_names);
+  names[count] = NULL;
+  return names;
+}
+
+// Totals for one document class.
+typedef struct {
+  size_t files;
+  size_t bytes;
+  double seconds;
+  double timed_bytes;
+  double pipeline_seconds;
+  size_t allocations;
+  size_t reallocations;
+  size_t peak_bytes;
+  size_t mismatches;
+} ClassStats;
+
+// The options zimwriterfs parses its pages with.
+static GumboOptions zimwriterfs_options(void) {
+  GumboOptions options = kGumboDefaultOptions;
+  options.lean = true;
+  options.zero_copy_text = true;
+  options.lazy_attribute_values = true;
+  return options;
+}
+
+// Feeds the input to a push parser in chunks of chunk_size bytes.  The output
+// points into the parser, to be destroyed after it.
+static GumboOutput* push_parse(
+    const GumboOptions* options, const char* data, size_t length,
+    size_t expected_length, size_t chunk_size, GumboPushParser** parser) {
+  *parser = gumbo_parser_create(options, expected_length);
+  for (size_t i = 0; i < length; i += chunk_size) {
+    size_t chunk = length - i < chunk_size ? length - i : chunk_size;
+    if (!gumbo_parser_feed(*parser, data + i, chunk)) {
+      break;
+    }
+  }
+  return gumbo_parser_finish(*parser);
+}
+
+// Gives every href and src attribute a new value, with characters that the
+// serializer has to escape, as zimwriterfs does to rewrite links.
+static void rewrite_links(const GumboOptions* options, GumboNode* node) {
+  while (node) {
+    if (node->type == GUMBO_NODE_ELEMENT) {
+      const GumboVector* attributes = &node->v.element.attributes;
+      for (int i = 0; i < attributes->length; ++i) {
+        GumboAttribute* attr = attributes->data[i];
+        if (strcmp(attr->name, "href") && strcmp(attr->name, "src")) {
+          continue;
+        }
+        Text value = {NULL, 0, 0};
+        GumboStringPiece piece = gumbo_attribute_value_piece(attr);
+        text_append(&value, "../\"I\"/", 7);
+        text_append(&value, piece.data, piece.length);
+        text_append(&value, "?a=1&b=2", 8);
+        gumbo_attribute_set_value(options, attr, value.data);
+        free(value.data);
+      }
+    }
+    const GumboVector* children = children_of(node);
+    if (children && children->length > 0) {
+      node = children->data[0];
+      continue;
+    }
+    for (; node->parent; node = node->parent) {
+      const GumboVector* siblings = children_of(node->parent);
+      if (node->index_within_parent + 1 < siblings->length) {
+        break;
+      }
+    }
+    node = node->parent ?
+        children_of(node->parent)->data[node->index_within_parent + 1] : NULL;
+  }
+}
+
+static void check_same(const char* path, const char* what,
+                       const Text* expected, const Text* actual,
+                       ClassStats* totals) {
+  if (expected->length != actual->length ||
+      memcmp(expected->data, actual->data, actual->length)) {
+    report_difference(path, what, expected, actual);
+    ++totals->mismatches;
+  }
+}
+
+// Compares a dump with its golden file, or rewrites the file with --update.  If
+// 'fallback' is given, it stands for a missing golden file, and --update only
+// writes one when the dump differs from it.
+static void check_golden(
+    const char* golden, const char* what, const Text* dump,
+    const Text* fallback, bool update, ClassStats* totals) {
+  bool same_as_fallback = fallback && fallback->length == dump->length &&
+      !memcmp(fallback->data, dump->data, dump->length);
+  if (update) {
+    if (same_as_fallback) {
+      remove(golden);
+    } else if (!write_file(golden, dump)) {
+      fprintf(stderr, "%s: can't write\n", golden);
+      ++totals->mismatches;
+    }
+    return;
+  }
+  Text expected = {NULL, 0, 0};
+  text_reserve(&expected, 0);
+  if (read_file(golden, &expected)) {
+    check_same(golden, what, &expected, dump, totals);
+  } else if (fallback) {
+    check_same(golden, what, fallback, dump, totals);
+  } else {
+    fprintf(stderr, "%s: can't read\n", golden);
+    ++totals->mismatches;
+  }
+  free(expected.data);
+}
+
+static void run_file(
+    const char* root, const char* class_name, const char* name, bool update,
+    bool timing, ClassStats* totals) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/corpus/%s/%s", root, class_name, name);
+  Text html = {NULL, 0, 0};
+  text_reserve(&html, 0);
+  if (!read_file(path, &html)) {
+    fprintf(stderr, "%s: can't read\n", path);
+    ++totals->mismatches;
+    return;
+  }
+  char golden[4096];
+  int golden_length = snprintf(golden, sizeof(golden), "%s/golden/%s/%.*s",
+                               root, class_name, (int) (strlen(name) - 5),
+                               name);
+
+  HeapStats stats = {0, 0, 0, 0};
+  GumboOptions options = kGumboDefaultOptions;
+  options.allocator = counting_allocate;
+  options.deallocator = counting_deallocate;
+  options.reallocator = counting_reallocate;
+  options.userdata = &stats;
+
+  // The default tree, against its golden dump.
+  GumboOutput* output =
+      gumbo_parse_with_options(&options, html.data, html.length);
+  HeapStats parse_stats = stats;
+  Text dump = {NULL, 0, 0};
+  text_reserve(&dump, 0);
+  dump_output(&dump, output, html.data, kDumpAll);
+  snprintf(golden + golden_length, sizeof(golden) - golden_length, ".txt");
+  check_golden(golden, "tree", &dump, NULL, update, totals);
+
+  // The tokenizer events, against theirs.
+  Text events = {NULL, 0, 0};
+  text_reserve(&events, 0);
+  EventDump event_dump = {&events, html.data};
+  GumboOptions event_options = kGumboDefaultOptions;
+  event_options.userdata = &event_dump;
+  gumbo_tokenize(&event_options, html.data, html.length, dump_event);
+  snprintf(golden + golden_length, sizeof(golden) - golden_length,
+           ".events.txt");
+  check_golden(golden, "events", &events, NULL, update, totals);
+  free(events.data);
+
+  // The flat document, against the default tree.
+  Text tree = {NULL, 0, 0};
+  Text flat = {NULL, 0, 0};
+  text_reserve(&tree, 0);
+  text_reserve(&flat, 0);
+  dump_tree(&tree, output, html.data);
+  GumboFlatDocument* document =
+      gumbo_flatten(&kGumboDefaultOptions, output, html.data);
+  dump_flat(&flat, document);
+  gumbo_destroy_flat_document(&kGumboDefaultOptions, document);
+  check_same(path, "flat document", &tree, &flat, totals);
+  free(tree.data);
+  free(flat.data);
+
+  // The tree of zimwriterfs options, in one go and pushed in chunks, against
+  // the default tree.
+  Text expected = {NULL, 0, 0};
+  Text actual = {NULL, 0, 0};
+  text_reserve(&expected, 0);
+  text_reserve(&actual, 0);
+  dump_output(&expected, output, html.data, kDumpOffsets | kDumpParseFlags);
+  GumboOptions lean = zimwriterfs_options();
+  GumboOutput* lean_output =
+      gumbo_parse_with_options(&lean, html.data, html.length);
+  dump_output(&actual, lean_output, html.data, kDumpOffsets | kDumpParseFlags);
+  check_same(path, "lean tree", &expected, &actual, totals);
+  for (size_t i = 0; i < sizeof(kPushChunkSizes) / sizeof(kPushChunkSizes[0]);
+       ++i) {
+    GumboPushParser* parser;
+    GumboOutput* pushed_output = push_parse(
+        &lean, html.data, html.length, 0, kPushChunkSizes[i], &parser);
+    actual.length = 0;
+    dump_output(&actual, pushed_output, NULL, kDumpOffsets | kDumpParseFlags);
+    check_same(path, "pushed tree", &expected, &actual, totals);
+    gumbo_destroy_output(&lean, pushed_output);
+    gumbo_parser_destroy(parser);
+  }
+
+  // The serialization of that tree, against the source.  Then, if it was the
+  // source, the serialization of that tree with its links rewritten, parsed
+  // back, against the default tree with the same links.
+  GumboHtmlBuffer buffer = {NULL, 0, 0};
+  gumbo_serialize(&lean, lean_output->document, &buffer);
+  Text serialized = {NULL, 0, 0};
+  text_append(&serialized, buffer.data ? buffer.data : "", buffer.length);
+  snprintf(golden + golden_length, sizeof(golden) - golden_length,
+           ".serialized.html");
+  check_golden(golden, "serialization", &serialized, &html, update, totals);
+  if (serialized.length == html.length &&
+      !memcmp(serialized.data, html.data, html.length)) {
+    rewrite_links(&options, output->document);
+    rewrite_links(&lean, lean_output->document);
+    buffer.length = 0;
+    gumbo_serialize(&lean, lean_output->document, &buffer);
+    serialized.length = 0;
+    text_append(&serialized, buffer.data ? buffer.data : "", buffer.length);
+    expected.length = 0;
+    actual.length = 0;
+    dump_output(&expected, output, html.data, 0);
+    GumboOutput* reparsed_output = gumbo_parse_with_options(
+        &kGumboDefaultOptions, serialized.data, serialized.length);
+    dump_output(&actual, reparsed_output, serialized.data, 0);
+    check_same(path, "reparsed tree", &expected, &actual, totals);
+    gumbo_destroy_output(&kGumboDefaultOptions, reparsed_output);
+  }
+  gumbo_destroy_html_buffer(&lean, &buffer);
+  gumbo_destroy_output(&lean, lean_output);
+  free(serialized.data);
+  free(expected.data);
+  free(actual.data);
+
+  gumbo_destroy_output(&options, output);
+  free(dump.data);
+
+  ++totals->files;
+  totals->bytes += html.length;
+  totals->allocations += parse_stats.allocations;
+  totals->reallocations += parse_stats.reallocations;
+  if (parse_stats.peak_bytes > totals->peak_bytes) {
+    totals->peak_bytes = parse_stats.peak_bytes;
+  }
+
+  if (timing) {
+    // Time the parse alone, with the default allocator, then the push parse
+    // and serialization of zimwriterfs.
+    size_t iterations = html.length ? kBytesPerTiming / html.length : 0;
+    if (iterations < kMinIterations) {
+      iterations = kMinIterations;
+    } else if (iterations > kMaxIterations) {
+      iterations = kMaxIterations;
+    }
+    clock_t start = clock();
+    for (size_t i = 0; i < iterations; ++i) {
+      output = gumbo_parse_with_options(
+          &kGumboDefaultOptions, html.data, html.length);
+      gumbo_destroy_output(&kGumboDefaultOptions, output);
+    }
+    totals->seconds += (double) (clock() - start) / CLOCKS_PER_SEC;
+    totals->timed_bytes += (double) html.length * iterations;
+
+    GumboPushParser* parser = gumbo_parser_create(&lean, html.length);
+    start = clock();
+    for (size_t i = 0; i < iterations; ++i) {
+      gumbo_parser_reset(parser, html.length);
+      gumbo_parser_feed(parser, html.data, html.length);
+      output = gumbo_parser_finish(parser);
+      buffer.length = 0;
+      gumbo_serialize(&lean, output->document, &buffer);
+      gumbo_destroy_output(&lean, output);
+    }
+    totals->pipeline_seconds += (double) (clock() - start) / CLOCKS_PER_SEC;
+    gumbo_destroy_html_buffer(&lean, &buffer);
+    gumbo_parser_destroy(parser);
+  }
+  free(html.data);
+}
+
+int main(int argc, char** argv) {
+  bool update = false;
+  bool timing = true;
+  const char* root = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--update")) {
+      update = true;
+    } else if (!strcmp(argv[i], "--quick")) {
+      timing = false;
+    } else if (!root && argv[i][0] != '-') {
+      root = argv[i];
+    } else {
+      root = NULL;
+      break;
+    }
+  }
+  if (!root) {
+    fprintf(stderr, "usage: %s [--update] [--quick] DIRECTORY\n", argv[0]);
+    return 2;
+  }
+
+  size_t mismatches = 0;
+  printf("%-10s %5s %9s %8s %8s %11s %13s %8s\n", "class", "files", "bytes",
+         "MB/s", "zw MB/s", "allocs/doc", "reallocs/doc", "peak KB");
+  for (size_t c = 0; c < sizeof(kClasses) / sizeof(kClasses[0]); ++c) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/corpus/%s", root, kClasses[c]);
+    char** names = list_html_files(path);
+    if (!names) {
+      fprintf(stderr, "%s: can't list\n", path);
+      ++mismatches;
+      continue;
+    }
+    ClassStats totals;
+    memset(&totals, 0, sizeof(totals));
+    for (char** name = names; *name; ++name) {
+      run_file(root, kClasses[c], *name, update, timing, &totals);
+      free(*name);
+    }
+    free(names);
+    mismatches += totals.mismatches;
+
+    size_t files = totals.files ? totals.files : 1;
+    printf("%-10s %5lu %9lu ", kClasses[c], (unsigned long) totals.files,
+           (unsigned long) totals.bytes);
+    if (timing && totals.seconds > 0 && totals.pipeline_seconds > 0) {
+      printf("%8.2f %8.2f", totals.timed_bytes / totals.seconds / (1 << 20),
+             totals.timed_bytes / totals.pipeline_seconds / (1 << 20));
+    } else {
+      printf("%8s %8s", "-", "-");
+    }
+    printf(" %11.1f %13.1f %8.1f\n",
+           (double) totals.allocations / files,
+           (double) totals.reallocations / files,
+           totals.peak_bytes / 1024.0);
+  }
+
+  if (mismatches) {
+    fprintf(stderr, "%lu check(s) failed\n",
+            (unsigned long) mismatches);
+    return 1;
+  }
+  return 0;
+}
@@ -182,7 +182,8 @@ typedef struct GumboInternalError {
 
 // Adds a new error to the parser's error list, and returns a pointer to it so
 // that clients can fill out the rest of its fields.  May return NULL if we're
-// already over the max_errors field specified in GumboOptions.
+// already over the max_errors field specified in GumboOptions, or if the
+// options ask for a lean parse.
 GumboError* gumbo_add_error(struct GumboInternalParser* parser);
 
 // Initializes the errors vector in the parser.
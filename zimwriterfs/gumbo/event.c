@@ -0,0 +1,198 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Callback-driven tokenization: gumbo_tokenize runs the tokenizer on its own
+// and hands every token to the caller instead of the tree construction stage.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gumbo.h"
+#include "parser.h"
+#include "string_buffer.h"
+#include "tokenizer.h"
+#include "vector.h"
+
+// State threaded through a gumbo_tokenize run.
+typedef struct {
+  GumboParser* parser;
+  GumboEventFunction callback;
+  void* userdata;
+
+  // The decoded text of the run of character tokens seen since the last
+  // non-character token, and the span of source it came from.
+  GumboStringBuffer text;
+  const char* text_start;
+  const char* text_end;
+
+  // Number of <svg> and <math> elements currently open.  Tags inside them
+  // don't switch the tokenizer state, and CDATA sections are recognized.
+  int foreign_depth;
+} EventState;
+
+// Reports the pending run of text, if any.  Returns the callback's verdict.
+static bool flush_text(EventState* state) {
+  if (state->text_start == NULL) {
+    return true;
+  }
+  gumbo_string_buffer_reserve(
+      state->parser, state->text.length + 1, &state->text);
+  state->text.data[state->text.length] = '\0';
+
+  GumboEvent event;
+  event.type = GUMBO_EVENT_TEXT;
+  event.original_text.data = state->text_start;
+  event.original_text.length = state->text_end - state->text_start;
+  event.tag = GUMBO_TAG_UNKNOWN;
+  event.text = state->text.data;
+  event.attributes = &kGumboEmptyVector;
+  event.is_self_closing = false;
+
+  state->text.length = 0;
+  state->text_start = NULL;
+  return state->callback(state->userdata, &event);
+}
+
+// Mirrors the tokenizer state changes the tree construction stage makes when
+// it inserts an element for this start tag.
+static void switch_tokenizer_state(EventState* state, const GumboToken* token) {
+  GumboTag tag = token->v.start_tag.tag;
+  if (state->foreign_depth > 0) {
+    if ((tag == GUMBO_TAG_SVG || tag == GUMBO_TAG_MATH) &&
+        !token->v.start_tag.is_self_closing) {
+      ++state->foreign_depth;
+    }
+    return;
+  }
+  switch (tag) {
+    case GUMBO_TAG_TITLE:
+    case GUMBO_TAG_TEXTAREA:
+      gumbo_tokenizer_set_state(state->parser, GUMBO_LEX_RCDATA);
+      break;
+    case GUMBO_TAG_STYLE:
+    case GUMBO_TAG_XMP:
+    case GUMBO_TAG_IFRAME:
+    case GUMBO_TAG_NOEMBED:
+    case GUMBO_TAG_NOFRAMES:
+      gumbo_tokenizer_set_state(state->parser, GUMBO_LEX_RAWTEXT);
+      break;
+    case GUMBO_TAG_SCRIPT:
+      gumbo_tokenizer_set_state(state->parser, GUMBO_LEX_SCRIPT);
+      break;
+    case GUMBO_TAG_PLAINTEXT:
+      gumbo_tokenizer_set_state(state->parser, GUMBO_LEX_PLAINTEXT);
+      break;
+    case GUMBO_TAG_SVG:
+    case GUMBO_TAG_MATH:
+      if (!token->v.start_tag.is_self_closing) {
+        ++state->foreign_depth;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// Reports a non-character token.  Returns the callback's verdict.
+static bool report_token(EventState* state, GumboToken* token) {
+  GumboEvent event;
+  event.original_text = token->original_text;
+  event.tag = GUMBO_TAG_UNKNOWN;
+  event.text = NULL;
+  event.attributes = &kGumboEmptyVector;
+  event.is_self_closing = false;
+  switch (token->type) {
+    case GUMBO_TOKEN_DOCTYPE:
+      event.type = GUMBO_EVENT_DOCTYPE;
+      event.text = token->v.doc_type.name ? token->v.doc_type.name : "";
+      break;
+    case GUMBO_TOKEN_START_TAG:
+      event.type = GUMBO_EVENT_START_TAG;
+      event.tag = token->v.start_tag.tag;
+      event.attributes = &token->v.start_tag.attributes;
+      event.is_self_closing = token->v.start_tag.is_self_closing;
+      switch_tokenizer_state(state, token);
+      break;
+    case GUMBO_TOKEN_END_TAG:
+      event.type = GUMBO_EVENT_END_TAG;
+      event.tag = token->v.end_tag;
+      if (state->foreign_depth > 0 &&
+          (event.tag == GUMBO_TAG_SVG || event.tag == GUMBO_TAG_MATH)) {
+        --state->foreign_depth;
+      }
+      break;
+    case GUMBO_TOKEN_COMMENT:
+      event.type = GUMBO_EVENT_COMMENT;
+      event.text = token->v.text;
+      break;
+    default:
+      assert(0);
+      return true;
+  }
+  return state->callback(state->userdata, &event);
+}
+
+bool gumbo_tokenize(
+    const GumboOptions* options, const char* buffer, size_t length,
+    GumboEventFunction callback) {
+  // Errors would need a GumboOutput to live in; lean mode never records any.
+  GumboOptions lean_options = *options;
+  lean_options.lean = true;
+  GumboParser parser;
+  parser._options = &lean_options;
+  parser._output = NULL;
+  parser._parser_state = NULL;
+  gumbo_tokenizer_state_init(&parser, buffer, length);
+
+  EventState state;
+  state.parser = &parser;
+  state.callback = callback;
+  state.userdata = options->userdata;
+  gumbo_string_buffer_init(&parser, &state.text);
+  state.text_start = NULL;
+  state.text_end = NULL;
+  state.foreign_depth = 0;
+
+  bool keep_going = true;
+  GumboToken token;
+  do {
+    gumbo_tokenizer_set_is_current_node_foreign(
+        &parser, state.foreign_depth > 0);
+    gumbo_lex(&parser, &token);
+    switch (token.type) {
+      case GUMBO_TOKEN_CHARACTER:
+      case GUMBO_TOKEN_WHITESPACE:
+        if (state.text_start == NULL) {
+          state.text_start = token.original_text.data;
+        }
+        state.text_end =
+            token.original_text.data + token.original_text.length;
+        gumbo_string_buffer_append_codepoint(
+            &parser, token.v.character, &state.text);
+        break;
+      case GUMBO_TOKEN_NULL:
+        break;
+      case GUMBO_TOKEN_EOF:
+        keep_going = flush_text(&state);
+        break;
+      default:
+        keep_going = flush_text(&state) && report_token(&state, &token);
+        gumbo_token_destroy(&parser, &token);
+        break;
+    }
+  } while (keep_going && token.type != GUMBO_TOKEN_EOF);
+
+  gumbo_string_buffer_destroy(&parser, &state.text);
+  gumbo_tokenizer_state_destroy(&parser);
+  return keep_going;
+}
@@ -0,0 +1,269 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Flattening of a parse tree into index-linked arrays; see GumboFlatDocument.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gumbo.h"
+#include "parser.h"
+#include "util.h"
+
+// Returns the children of an element or document node, or NULL for nodes that
+// can't have any.
+static const GumboVector* children_of(const GumboNode* node) {
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      return &node->v.document.children;
+    case GUMBO_NODE_ELEMENT:
+      return &node->v.element.children;
+    default:
+      return NULL;
+  }
+}
+
+// Returns the node following 'node' in a pre-order walk of the tree, or NULL if
+// 'node' is the last one.  *depth is adjusted by the levels moved down or up.
+static const GumboNode* next_node(const GumboNode* node, size_t* depth) {
+  const GumboVector* children = children_of(node);
+  if (children && children->length > 0) {
+    ++*depth;
+    return children->data[0];
+  }
+  while (node->parent) {
+    const GumboVector* siblings = children_of(node->parent);
+    if (node->index_within_parent + 1 < siblings->length) {
+      return siblings->data[node->index_within_parent + 1];
+    }
+    node = node->parent;
+    --*depth;
+  }
+  return NULL;
+}
+
+// Returns the string stored for the node in the strings pool, or an empty piece
+// if there's none.  For elements, that's the tag name as found in the source;
+// see add_tag_name.
+static GumboStringPiece node_text(const GumboNode* node) {
+  GumboStringPiece text = kGumboEmptyString;
+  switch (node->type) {
+    case GUMBO_NODE_ELEMENT:
+      if (node->v.element.tag == GUMBO_TAG_UNKNOWN &&
+          node->v.element.original_tag.length > 0) {
+        text = node->v.element.original_tag;
+        gumbo_tag_from_original_text(&text);
+      }
+      break;
+    case GUMBO_NODE_TEXT:
+    case GUMBO_NODE_CDATA:
+    case GUMBO_NODE_COMMENT:
+    case GUMBO_NODE_WHITESPACE:
+      text.data = node->v.text.text;
+      // Slices of the original buffer (see zero_copy_text) aren't terminated.
+      text.length = text.data == node->v.text.original_text.data ?
+          node->v.text.original_text.length : strlen(text.data);
+      break;
+    default:
+      break;
+  }
+  return text;
+}
+
+// Returns the length of a tag name once normalized by add_tag_name.
+static size_t tag_name_length(GumboStringPiece name) {
+  size_t length = name.length;
+  for (size_t i = 0; i < name.length; ++i) {
+    if (name.data[i] == '\0') {
+      length += 2;
+    }
+  }
+  return length;
+}
+
+// Returns the part of the buffer the node was parsed from.
+static GumboStringPiece node_source(const GumboNode* node) {
+  switch (node->type) {
+    case GUMBO_NODE_ELEMENT:
+      return node->v.element.original_tag;
+    case GUMBO_NODE_DOCUMENT:
+      return kGumboEmptyString;
+    default:
+      return node->v.text.original_text;
+  }
+}
+
+// Returns the room a string of this length takes up in the pool.
+static size_t pooled_length(size_t length) {
+  return length ? length + 1 : 0;
+}
+
+// Appends a string and its terminator to the pool; returns its offset.
+static uint32_t add_string(
+    GumboFlatDocument* document, const char* data, size_t length) {
+  if (length == 0) {
+    return 0;  // The pool starts with an empty string.
+  }
+  uint32_t offset = document->strings_length;
+  memcpy(document->strings + offset, data, length);
+  document->strings[offset + length] = '\0';
+  document->strings_length += length + 1;
+  return offset;
+}
+
+// Appends the tag name of an unknown element to the pool the way the tokenizer
+// normalizes it, ASCII letters lowercased and NULs replaced by U+FFFD, since
+// the raw name would be cut short at a NUL; returns its offset.
+static uint32_t add_tag_name(
+    GumboFlatDocument* document, GumboStringPiece name) {
+  if (name.length == 0) {
+    return 0;
+  }
+  uint32_t offset = document->strings_length;
+  char* out = document->strings + offset;
+  for (size_t i = 0; i < name.length; ++i) {
+    char c = name.data[i];
+    if (c == '\0') {
+      memcpy(out, "\xEF\xBF\xBD", 3);
+      out += 3;
+    } else {
+      *out++ = c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+    }
+  }
+  *out = '\0';
+  document->strings_length = out + 1 - document->strings;
+  return offset;
+}
+
+GumboFlatDocument* gumbo_flatten(
+    const GumboOptions* options, const GumboOutput* output,
+    const char* buffer) {
+  GumboParser parser;
+  parser._options = options;
+
+  // Size everything up first so that the whole document is a single block.
+  size_t node_count = 0;
+  size_t attribute_count = 0;
+  size_t strings_length = 1;
+  size_t depth = 0;
+  size_t max_depth = 0;
+  for (const GumboNode* node = output->document; node;
+       node = next_node(node, &depth)) {
+    ++node_count;
+    if (depth > max_depth) {
+      max_depth = depth;
+    }
+    GumboStringPiece text = node_text(node);
+    strings_length += pooled_length(node->type == GUMBO_NODE_ELEMENT ?
+        tag_name_length(text) : text.length);
+    if (node->type == GUMBO_NODE_ELEMENT) {
+      const GumboVector* attributes = &node->v.element.attributes;
+      attribute_count += attributes->length;
+      for (int i = 0; i < attributes->length; ++i) {
+        const GumboAttribute* attr = attributes->data[i];
+        strings_length += pooled_length(strlen(attr->name)) +
+            pooled_length(gumbo_attribute_value_piece(attr).length);
+      }
+    }
+  }
+  assert(node_count < GUMBO_FLAT_NONE);
+  assert(strings_length < GUMBO_FLAT_NONE);
+
+  GumboFlatDocument* document = gumbo_parser_allocate(
+      &parser, sizeof(GumboFlatDocument) +
+      sizeof(GumboFlatNode) * node_count +
+      sizeof(GumboFlatAttribute) * attribute_count + strings_length);
+  document->nodes = (GumboFlatNode*) (document + 1);
+  document->node_count = node_count;
+  document->attributes =
+      (GumboFlatAttribute*) (document->nodes + node_count);
+  document->attribute_count = 0;
+  document->strings = (char*) (document->attributes + attribute_count);
+  document->strings[0] = '\0';
+  document->strings_length = 1;
+
+  // open[d] is the node being filled in at depth d, and last_child[d] the most
+  // recent node at depth d under open[d - 1].
+  uint32_t* open =
+      gumbo_parser_allocate(&parser, sizeof(uint32_t) * (max_depth + 2) * 2);
+  uint32_t* last_child = open + max_depth + 2;
+
+  uint32_t index = 0;
+  depth = 0;
+  for (const GumboNode* node = output->document; node;
+       node = next_node(node, &depth), ++index) {
+    GumboFlatNode* flat = &document->nodes[index];
+    flat->first_child = GUMBO_FLAT_NONE;
+    flat->next_sibling = GUMBO_FLAT_NONE;
+    if (depth == 0) {
+      flat->parent = GUMBO_FLAT_NONE;
+    } else {
+      flat->parent = open[depth - 1];
+      if (last_child[depth] == GUMBO_FLAT_NONE) {
+        document->nodes[flat->parent].first_child = index;
+      } else {
+        document->nodes[last_child[depth]].next_sibling = index;
+      }
+      last_child[depth] = index;
+    }
+    open[depth] = index;
+    last_child[depth + 1] = GUMBO_FLAT_NONE;
+
+    flat->type = node->type;
+    flat->tag = GUMBO_TAG_UNKNOWN;
+    flat->tag_namespace = GUMBO_NAMESPACE_HTML;
+    flat->first_attribute = document->attribute_count;
+    flat->attribute_count = 0;
+    if (node->type == GUMBO_NODE_ELEMENT) {
+      const GumboElement* element = &node->v.element;
+      flat->tag = element->tag;
+      flat->tag_namespace = element->tag_namespace;
+      flat->attribute_count = element->attributes.length;
+      for (int i = 0; i < element->attributes.length; ++i) {
+        const GumboAttribute* attr = element->attributes.data[i];
+        GumboFlatAttribute* flat_attr =
+            &document->attributes[document->attribute_count++];
+        flat_attr->name = add_string(document, attr->name, strlen(attr->name));
+        GumboStringPiece value = gumbo_attribute_value_piece(attr);
+        flat_attr->value = add_string(document, value.data, value.length);
+      }
+    }
+    GumboStringPiece text = node_text(node);
+    flat->text = node->type == GUMBO_NODE_ELEMENT ?
+        add_tag_name(document, text) :
+        add_string(document, text.data, text.length);
+
+    GumboStringPiece source = node_source(node);
+    if (source.length > 0) {
+      flat->source_offset = source.data - buffer;
+    } else {
+      flat->source_offset = node->type == GUMBO_NODE_ELEMENT ?
+          node->v.element.start_pos.offset : 0;
+    }
+    flat->source_length = source.length;
+  }
+  assert(index == node_count);
+  assert(document->strings_length == strings_length);
+
+  gumbo_parser_deallocate(&parser, open);
+  return document;
+}
+
+void gumbo_destroy_flat_document(
+    const GumboOptions* options, GumboFlatDocument* document) {
+  GumboParser parser;
+  parser._options = options;
+  gumbo_parser_deallocate(&parser, document);
+}
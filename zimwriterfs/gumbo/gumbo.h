@@ -44,6 +44,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -405,7 +406,9 @@ typedef struct {
    * The value of the attribute.  This is in a freshly-allocated buffer to deal
    * with unescaping, and is null-terminated.  It does not include any quotes
    * that surround the attribute.  If the attribute has no value (for example,
-   * 'selected' on a checkbox), this will be an empty string.
+   * 'selected' on a checkbox), this will be an empty string.  With the
+   * lazy_attribute_values option, this is NULL while the value is a verbatim
+   * copy of its original text; see gumbo_attribute_value.
    */
   const char* value;
 
@@ -434,6 +437,12 @@ typedef struct {
 
   /** The ending position of the attribute value. */
   GumboSourcePosition value_end;
+
+  /**
+   * Set by gumbo_attribute_set_value once the value no longer corresponds to
+   * original_value; gumbo_serialize then writes out the value instead.
+   */
+  bool value_replaced;
 } GumboAttribute;
 
 /**
@@ -586,6 +595,12 @@ typedef struct {
   const char* public_identifier;
   const char* system_identifier;
 
+  /**
+   * The doctype token as it appears in the source, or an empty string piece if
+   * there was none.
+   */
+  GumboStringPiece original_doctype;
+
   /**
    * Whether or not the document is in QuirksMode, as determined by the values
    * in the GumboTokenDocType template.
@@ -600,7 +615,9 @@ typedef struct {
 typedef struct {
   /**
    * The text of this node, after entities have been parsed and decoded.  For
-   * comment/cdata nodes, this does not include the comment delimiters.
+   * comment/cdata nodes, this does not include the comment delimiters.  With
+   * the zero_copy_text option, this may be a non-NUL-terminated slice of the
+   * original buffer; see GumboOptions.
    */
   const char* text;
 
@@ -691,6 +708,27 @@ struct GumboInternalNode {
   } v;
 };
 
+/**
+ * Returns the node that follows 'node' in document order (a pre-order walk)
+ * within the subtree rooted at 'root', or NULL once the subtree is done.  The
+ * walk follows the parent and index_within_parent links, so it takes no stack
+ * however deeply the document is nested:
+ *
+ *   for (GumboNode* node = root; node; node = gumbo_next_node(root, node)) {
+ *     ...
+ *   }
+ *
+ * The tree may be changed along the way as long as neither 'node' nor any of
+ * its ancestors up to 'root' is moved, and its children vector is left alone.
+ */
+GumboNode* gumbo_next_node(const GumboNode* root, const GumboNode* node);
+
+/**
+ * Like gumbo_next_node, but skips the descendants of 'node'.
+ */
+GumboNode* gumbo_next_node_skipping_children(
+    const GumboNode* root, const GumboNode* node);
+
 /**
  * The type for an allocator function.  Takes the 'userdata' member of the
  * GumboParser struct as its first argument.  Semantics should be the same as
@@ -706,6 +744,25 @@ typedef void* (*GumboAllocatorFunction)(void* userdata, size_t size);
  */
 typedef void (*GumboDeallocatorFunction)(void* userdata, void* ptr);
 
+/**
+ * The type for a reallocator function.  Takes the 'userdata' member of the
+ * GumboParser struct as its first argument.  Semantics should be the same as
+ * realloc on a block of old_size bytes obtained from the allocator, whose
+ * contents must be preserved up to the smaller of the two sizes.  An arena
+ * allocator can use old_size to extend the most recent block in place.
+ */
+typedef void* (*GumboReallocatorFunction)(
+    void* userdata, void* ptr, size_t old_size, size_t new_size);
+
+/**
+ * The type for an early-termination predicate.  Takes the 'userdata' member of
+ * the GumboOptions struct as its first argument, and is called with every
+ * element as soon as it has been inserted into the tree: its tag, attributes
+ * and parent are available, its children are not.  Returning true ends the
+ * parse after the current token.
+ */
+typedef bool (*GumboStopFunction)(void* userdata, const GumboNode* element);
+
 /**
  * Input struct containing configuration options for the parser.
  * These let you specify alternate memory managers, provide different error
@@ -745,6 +802,64 @@ typedef struct GumboInternalOptions {
    * Default: -1
    */
   int max_errors;
+
+  /**
+   * Skip the bookkeeping that is only useful for diagnostics.  When set, no
+   * errors are recorded at all (the errors vector stays empty regardless of
+   * max_errors) and source positions carry only the byte offset: line and
+   * column are left at 0 and tab stops are never computed.  original_text
+   * spans are unaffected.  Default: false.
+   */
+  bool lean;
+
+  /**
+   * Whether to stop parsing as soon as the document leaves the <head>, ie. at
+   * the first token that belongs in the body (or a frameset).  The returned
+   * tree has the complete contents of <head>; <body> is either absent or
+   * empty.  Default: false.
+   */
+  bool stop_after_head;
+
+  /**
+   * An optional predicate that ends the parse early; see GumboStopFunction.
+   * Default: NULL.
+   */
+  GumboStopFunction stop_function;
+
+  /**
+   * Whether text and whitespace nodes whose text is a verbatim copy of their
+   * original_text (no character references, NULs or carriage returns) should
+   * point into the original buffer instead of owning a copy.  Such nodes have
+   * text == original_text.data, and their text is not NUL-terminated; use
+   * original_text.length.  Default: false.
+   */
+  bool zero_copy_text;
+
+  /**
+   * Whether whitespace-only runs of text should be left out of the tree
+   * instead of becoming GUMBO_NODE_WHITESPACE nodes.  This loses whitespace
+   * that matters for rendering, eg. inside <pre>.  Default: false.
+   */
+  bool drop_whitespace;
+
+  /**
+   * A memory reallocator function, used to grow vectors and string buffers.
+   * When NULL, growing uses realloc if allocator and deallocator are the
+   * defaults, and allocates a new block, copies and frees the old one
+   * otherwise.  Default: NULL.
+   */
+  GumboReallocatorFunction reallocator;
+
+  /**
+   * Whether attribute values that are a verbatim copy of their original text
+   * (no character references, NULs or carriage returns) should be left in the
+   * original buffer instead of being copied out as they're parsed.  Their
+   * value is NULL until gumbo_attribute_value is called; most attributes are
+   * never looked at, and this saves an allocation and a copy for each of them.
+   * gumbo_attribute_value_piece reads either kind without copying.  The
+   * buffer must outlive the tree for the values to be read.  Default: false.
+   */
+  bool lazy_attribute_values;
 } GumboOptions;
 
 /** Default options struct; use this with gumbo_parse_with_options. */
@@ -790,10 +905,275 @@ GumboOutput* gumbo_parse(const char* buffer);
 GumboOutput* gumbo_parse_with_options(
     const GumboOptions* options, const char* buffer, size_t buffer_length);
 
+/**
+ * Parses only as much of the buffer as is needed to build the <head>, as if
+ * options->stop_after_head were set.  Open elements are closed implicitly, so
+ * the result is an ordinary (partial) tree to be released with
+ * gumbo_destroy_output.
+ */
+GumboOutput* gumbo_parse_head(
+    const GumboOptions* options, const char* buffer, size_t buffer_length);
+
 /** Release the memory used for the parse tree & parse errors. */
 void gumbo_destroy_output(
     const GumboOptions* options, GumboOutput* output);
 
+/**
+ * An incremental parser, for input that arrives in chunks.  The tree built from
+ * a sequence of gumbo_parser_feed calls followed by gumbo_parser_finish is the
+ * same as the one gumbo_parse_with_options builds from the concatenated
+ * chunks.
+ */
+typedef struct GumboInternalPushParser GumboPushParser;
+
+/**
+ * Creates an incremental parser.  The options are copied.  The parser keeps its
+ * own contiguous copy of the input, which the tree points into; if that copy
+ * has to grow beyond expected_length, the parse so far is discarded and
+ * redone over the moved buffer.  Pass the input size if it's known, or 0.
+ */
+GumboPushParser* gumbo_parser_create(
+    const GumboOptions* options, size_t expected_length);
+
+/**
+ * Appends a chunk of input and parses as far as the input allows.  Chunks may
+ * split UTF-8 sequences, tags or character references anywhere.  Returns
+ * false once the parse has ended early (see stop_after_head and
+ * stop_function), after which further input isn't needed and is ignored.
+ */
+bool gumbo_parser_feed(
+    GumboPushParser* parser, const char* chunk, size_t chunk_length);
+
+/**
+ * Marks the end of input, completes the parse and returns its output.  The
+ * output points into the parser's copy of the input, so it must be released
+ * with gumbo_destroy_output before the parser is destroyed.  May only be
+ * called once.
+ */
+GumboOutput* gumbo_parser_finish(GumboPushParser* parser);
+
+/**
+ * Gets the parser ready for a new document, as if it had just been created with
+ * the same options.  The input buffer and the parser's internal stacks and
+ * buffers are kept, so parsing many documents in a row with one parser saves
+ * the setup and teardown of each.  The output of the previous document points
+ * into the input buffer and must be released first; a parse that wasn't
+ * finished is discarded.
+ *
+ * A parser holds no state shared with other parsers, so each thread may keep
+ * its own; a single parser must not be used by two threads at once.
+ */
+void gumbo_parser_reset(GumboPushParser* parser, size_t expected_length);
+
+/** Releases an incremental parser, finished or not. */
+void gumbo_parser_destroy(GumboPushParser* parser);
+
+/** The kinds of events reported by gumbo_tokenize. */
+typedef enum {
+  GUMBO_EVENT_DOCTYPE,
+  GUMBO_EVENT_START_TAG,
+  GUMBO_EVENT_END_TAG,
+  GUMBO_EVENT_TEXT,
+  GUMBO_EVENT_COMMENT
+} GumboEventType;
+
+/**
+ * A single token reported by gumbo_tokenize.  Everything it points to that is
+ * not part of the original buffer is only valid for the duration of the
+ * callback.
+ */
+typedef struct {
+  /** The type of the event. */
+  GumboEventType type;
+
+  /**
+   * The raw bytes of the token in the original buffer.  For text events this
+   * spans the whole run of characters, including any character references.
+   */
+  GumboStringPiece original_text;
+
+  /**
+   * The tag of START_TAG and END_TAG events; GUMBO_TAG_UNKNOWN for other
+   * events (and for unknown tags, whose name is in original_text).
+   */
+  GumboTag tag;
+
+  /**
+   * The decoded contents of TEXT and COMMENT events, and the name of DOCTYPE
+   * events, as a NUL-terminated UTF-8 string.  NULL for tag events.
+   */
+  const char* text;
+
+  /**
+   * The GumboAttribute* of START_TAG events.  Their original_name and
+   * original_value fields give the byte ranges of each attribute in the
+   * original buffer.  Empty for other events.
+   */
+  const GumboVector* attributes;
+
+  /** Whether a START_TAG event was written as <tag/>. */
+  bool is_self_closing;
+} GumboEvent;
+
+/**
+ * The type for a gumbo_tokenize callback.  Takes the 'userdata' member of the
+ * GumboOptions struct as its first argument.  Returns false to stop.
+ */
+typedef bool (*GumboEventFunction)(void* userdata, const GumboEvent* event);
+
+/**
+ * Runs only the tokenizer over the buffer and reports each token to the
+ * callback, without building a tree.  The tokenizer is switched into the
+ * RCDATA, RAWTEXT, script data and PLAINTEXT states after the corresponding
+ * start tags, as the tree builder would; outside of <svg> and <math> subtrees
+ * that is all the tree construction stage contributes to tokenization.
+ * Adjacent character tokens are merged into a single TEXT event, and NUL
+ * characters in data are dropped.  Nothing is done about misnested or
+ * missing tags: events are the tokens exactly as they appear in the source.
+ *
+ * The parse is always lean (see GumboOptions.lean): no errors are recorded.
+ * Returns false if the callback stopped the parse, true otherwise.
+ */
+bool gumbo_tokenize(
+    const GumboOptions* options, const char* buffer, size_t buffer_length,
+    GumboEventFunction callback);
+
+/** The value of a GumboFlatNode link that leads nowhere. */
+#define GUMBO_FLAT_NONE ((uint32_t) -1)
+
+/**
+ * A node of a GumboFlatDocument.  Links to other nodes are indices into the
+ * document's nodes array, and strings are offsets into its strings pool.
+ */
+typedef struct {
+  /** The parent, first child and next sibling, or GUMBO_FLAT_NONE. */
+  uint32_t parent;
+  uint32_t first_child;
+  uint32_t next_sibling;
+
+  /**
+   * The element's attributes are attributes[first_attribute] up to, but not
+   * including, attributes[first_attribute + attribute_count].
+   */
+  uint32_t first_attribute;
+  uint32_t attribute_count;
+
+  /**
+   * The decoded text of text, whitespace, CDATA and comment nodes, and the tag
+   * name of GUMBO_TAG_UNKNOWN elements as the tokenizer normalizes it
+   * (lowercase, with NULs replaced by U+FFFD); the empty string otherwise.
+   */
+  uint32_t text;
+
+  /**
+   * The byte range of the node's original_text (original_tag for elements) in
+   * the parsed buffer.  Empty for elements inserted by the parser.
+   */
+  uint32_t source_offset;
+  uint32_t source_length;
+
+  /** A GumboTag for elements, GUMBO_TAG_UNKNOWN otherwise. */
+  uint16_t tag;
+
+  /** A GumboNodeType. */
+  uint8_t type;
+
+  /** A GumboNamespaceEnum for elements. */
+  uint8_t tag_namespace;
+} GumboFlatNode;
+
+/** An attribute of a GumboFlatNode, as offsets into the strings pool. */
+typedef struct {
+  uint32_t name;
+  uint32_t value;
+} GumboFlatAttribute;
+
+/**
+ * A parse tree flattened into three arrays.  Nodes are stored in document
+ * order (a pre-order walk of the tree), starting with the document node at
+ * index 0, so a subtree is a contiguous range of nodes and a full scan is a
+ * linear sweep over memory.  Strings are NUL-terminated.
+ */
+typedef struct {
+  GumboFlatNode* nodes;
+  size_t node_count;
+  GumboFlatAttribute* attributes;
+  size_t attribute_count;
+  char* strings;
+  size_t strings_length;
+} GumboFlatDocument;
+
+/**
+ * Copies the tree of the output into a GumboFlatDocument, allocated as a
+ * single block.  'buffer' is the buffer that was parsed; source offsets are
+ * relative to it.  The flat document doesn't point into the output or the
+ * buffer, so both may be released right away.
+ */
+GumboFlatDocument* gumbo_flatten(
+    const GumboOptions* options, const GumboOutput* output,
+    const char* buffer);
+
+/** Releases a GumboFlatDocument. */
+void gumbo_destroy_flat_document(
+    const GumboOptions* options, GumboFlatDocument* document);
+
+/**
+ * A growable buffer that gumbo_serialize appends to.  Zero-initialize it before
+ * first use; it may be emptied by setting length to 0 and reused.  The text
+ * isn't NUL-terminated.
+ */
+typedef struct {
+  char* data;
+  size_t length;
+  size_t capacity;
+} GumboHtmlBuffer;
+
+/**
+ * Writes a node and its descendants back out as HTML, appending to 'output'.
+ * Whatever the parser took from the source is copied straight from the
+ * original_text, original_tag and original_end_tag spans, so the result
+ * reproduces the source, character references and formatting included.  Start
+ * and end tags that the parser implied aren't written out, and neither is the
+ * end tag of an element that was closed implicitly.  The doctype is copied
+ * from its original text as well.  Nodes the parser moved (misnested formatting elements,
+ * content foster-parented out of tables) come out in tree order, which may not
+ * parse back to quite the same tree.
+ *
+ * Start tags with an attribute replaced through gumbo_attribute_set_value are
+ * copied around the original value, which is swapped for the new one.  The
+ * cost of serializing is linear in the size of the document regardless of how
+ * many attributes were replaced.
+ */
+void gumbo_serialize(
+    const GumboOptions* options, const GumboNode* node,
+    GumboHtmlBuffer* output);
+
+/** Releases the storage of a GumboHtmlBuffer. */
+void gumbo_destroy_html_buffer(
+    const GumboOptions* options, GumboHtmlBuffer* buffer);
+
+/**
+ * Replaces the value of an attribute of a parse tree with a copy of 'value',
+ * for gumbo_serialize to write out in place of the original.
+ */
+void gumbo_attribute_set_value(
+    const GumboOptions* options, GumboAttribute* attribute, const char* value);
+
+/**
+ * Returns the value of an attribute without copying it: 'value' when it's set,
+ * otherwise the part of the original buffer that it's a verbatim copy of (see
+ * lazy_attribute_values), which isn't NUL-terminated.
+ */
+GumboStringPiece gumbo_attribute_value_piece(const GumboAttribute* attribute);
+
+/**
+ * Returns the value of an attribute, copying it out of the original buffer
+ * first if it was left there (see lazy_attribute_values).  The copy is owned
+ * by the attribute.
+ */
+const char* gumbo_attribute_value(
+    const GumboOptions* options, GumboAttribute* attribute);
+
 
 #ifdef __cplusplus
 }
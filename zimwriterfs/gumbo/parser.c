@@ -53,6 +53,13 @@ const GumboOptions kGumboDefaultOptions = {
   8,
   false,
   -1,
+  false,
+  false,
+  NULL,
+  false,
+  false,
+  NULL,
+  false,
 };
 
 static const GumboStringPiece kDoctypeHtml = GUMBO_STRING("html");
@@ -398,6 +405,12 @@ typedef struct GumboInternalParserState {
   // flag appropriately.
   bool _closed_body_tag;
   bool _closed_html_tag;
+
+  // Set when GumboOptions.stop_function has asked for the parse to end.
+  bool _stop_requested;
+
+  // Whether any token so far was a parse error, for stop_on_first_error.
+  bool _has_error;
 } GumboParserState;
 
 static bool token_has_attribute(const GumboToken* token, const char* name) {
@@ -405,12 +418,25 @@ static bool token_has_attribute(const GumboToken* token, const char* name) {
   return gumbo_get_attribute(&token->v.start_tag.attributes, name) != NULL;
 }
 
+// Checks if the value of an attribute is the 'length' bytes at 'value'.
+static bool attribute_value_equals(
+    const GumboAttribute* attr, const char* value, size_t length,
+    bool case_sensitive) {
+  GumboStringPiece attr_value = gumbo_attribute_value_piece(attr);
+  if (attr_value.length != length) {
+    return false;
+  }
+  return case_sensitive ? memcmp(value, attr_value.data, length) == 0 :
+      strncasecmp(value, attr_value.data, length) == 0;
+}
+
 // Checks if the value of the specified attribute is a case-insensitive match
 // for the specified string.
 static bool attribute_matches(
     const GumboVector* attributes, const char* name, const char* value) {
   const GumboAttribute* attr = gumbo_get_attribute(attributes, name);
-  return attr ? strcasecmp(value, attr->value) == 0 : false;
+  return attr ? attribute_value_equals(attr, value, strlen(value), false) :
+      false;
 }
 
 // Checks if the value of the specified attribute is a case-sensitive match
@@ -418,7 +444,8 @@ static bool attribute_matches(
 static bool attribute_matches_case_sensitive(
     const GumboVector* attributes, const char* name, const char* value) {
   const GumboAttribute* attr = gumbo_get_attribute(attributes, name);
-  return attr ?  strcmp(value, attr->value) == 0 : false;
+  return attr ? attribute_value_equals(attr, value, strlen(value), true) :
+      false;
 }
 
 // Checks if the specified attribute vectors are identical.
@@ -427,7 +454,10 @@ static bool all_attributes_match(
   int num_unmatched_attr2_elements = attr2->length;
   for (int i = 0; i < attr1->length; ++i) {
     const GumboAttribute* attr = attr1->data[i];
-    if (attribute_matches_case_sensitive(attr2, attr->name, attr->value)) {
+    const GumboAttribute* other = gumbo_get_attribute(attr2, attr->name);
+    GumboStringPiece value = gumbo_attribute_value_piece(attr);
+    if (other &&
+        attribute_value_equals(other, value.data, value.length, true)) {
       --num_unmatched_attr2_elements;
     } else {
       return false;
@@ -441,8 +471,47 @@ static void set_frameset_not_ok(GumboParser* parser) {
   parser->_parser_state->_frameset_ok = false;
 }
 
+// Element nodes are allocated with room for this many children right after the
+// GumboNode, so that the many elements with few children need no array of their
+// own.  The array moves to the heap when it fills up; see make_room_for_child.
+static const size_t kInlineChildren = 2;
+
+static size_t node_allocation_size(GumboNodeType type) {
+  return sizeof(GumboNode) +
+      (type == GUMBO_NODE_ELEMENT ? sizeof(void*) * kInlineChildren : 0);
+}
+
+static void** inline_children(const GumboNode* node) {
+  assert(node->type == GUMBO_NODE_ELEMENT);
+  return (void**) (node + 1);
+}
+
+// Points an element's children vector at its (empty) inline storage.
+static void init_inline_children(GumboNode* node) {
+  GumboVector* children = &node->v.element.children;
+  children->data = inline_children(node);
+  children->length = 0;
+  children->capacity = kInlineChildren;
+}
+
+// Moves a full inline children array to the heap, since the vector functions
+// may only grow arrays they can reallocate.
+static void make_room_for_child(GumboParser* parser, GumboNode* parent) {
+  GumboVector* children = &parent->v.element.children;
+  if (children->data != inline_children(parent) ||
+      children->length < children->capacity) {
+    return;
+  }
+  void** data = gumbo_parser_allocate(
+      parser, sizeof(void*) * children->capacity * 2);
+  memcpy(data, children->data, sizeof(void*) * children->length);
+  children->data = data;
+  children->capacity *= 2;
+}
+
 static GumboNode* create_node(GumboParser* parser, GumboNodeType type) {
-  GumboNode* node = gumbo_parser_allocate(parser, sizeof(GumboNode));
+  GumboNode* node =
+      gumbo_parser_allocate(parser, node_allocation_size(type));
   node->parent = NULL;
   node->index_within_parent = -1;
   node->type = type;
@@ -463,6 +532,7 @@ static GumboNode* new_document_node(GumboParser* parser) {
   document->name = NULL;
   document->public_identifier = NULL;
   document->system_identifier = NULL;
+  document->original_doctype = kGumboEmptyString;
   return document_node;
 }
 
@@ -474,25 +544,38 @@ static void output_init(GumboParser* parser) {
   gumbo_init_errors(parser);
 }
 
-static void parser_state_init(GumboParser* parser) {
-  GumboParserState* parser_state =
-      gumbo_parser_allocate(parser, sizeof(GumboParserState));
+// Gets the parser state ready for a new parse, keeping the storage of its stacks
+// and text buffer.
+static void parser_state_reset(GumboParser* parser) {
+  GumboParserState* parser_state = parser->_parser_state;
   parser_state->_insertion_mode = GUMBO_INSERTION_MODE_INITIAL;
   parser_state->_reprocess_current_token = false;
   parser_state->_frameset_ok = true;
   parser_state->_ignore_next_linefeed = false;
   parser_state->_foster_parent_insertions = false;
   parser_state->_text_node._type = GUMBO_NODE_WHITESPACE;
-  gumbo_string_buffer_init(parser, &parser_state->_text_node._buffer);
-  gumbo_vector_init(parser, 10, &parser_state->_open_elements);
-  gumbo_vector_init(parser, 5, &parser_state->_active_formatting_elements);
-  gumbo_vector_init(parser, 5, &parser_state->_template_insertion_modes);
+  gumbo_string_buffer_clear(parser, &parser_state->_text_node._buffer);
+  parser_state->_open_elements.length = 0;
+  parser_state->_active_formatting_elements.length = 0;
+  parser_state->_template_insertion_modes.length = 0;
   parser_state->_head_element = NULL;
   parser_state->_form_element = NULL;
   parser_state->_current_token = NULL;
   parser_state->_closed_body_tag = false;
   parser_state->_closed_html_tag = false;
+  parser_state->_stop_requested = false;
+  parser_state->_has_error = false;
+}
+
+static void parser_state_init(GumboParser* parser) {
+  GumboParserState* parser_state =
+      gumbo_parser_allocate(parser, sizeof(GumboParserState));
+  gumbo_string_buffer_init(parser, &parser_state->_text_node._buffer);
+  gumbo_vector_init(parser, 10, &parser_state->_open_elements);
+  gumbo_vector_init(parser, 5, &parser_state->_active_formatting_elements);
+  gumbo_vector_init(parser, 5, &parser_state->_template_insertion_modes);
   parser->_parser_state = parser_state;
+  parser_state_reset(parser);
 }
 
 static void parser_state_destroy(GumboParser* parser) {
@@ -746,6 +829,7 @@ static void append_node(
   assert(node->index_within_parent == -1);
   GumboVector* children;
   if (parent->type == GUMBO_NODE_ELEMENT) {
+    make_room_for_child(parser, parent);
     children = &parent->v.element.children;
   } else {
     assert(parent->type == GUMBO_NODE_DOCUMENT);
@@ -764,6 +848,7 @@ static void insert_node(
   assert(node->parent == NULL);
   assert(node->index_within_parent == -1);
   assert(parent->type == GUMBO_NODE_ELEMENT);
+  make_room_for_child(parser, parent);
   GumboVector* children = &parent->v.element.children;
   assert(index >= 0);
   assert(index < children->length);
@@ -826,14 +911,26 @@ static void maybe_flush_text_node_buffer(GumboParser* parser) {
 
   assert(buffer_state->_type == GUMBO_NODE_WHITESPACE ||
          buffer_state->_type == GUMBO_NODE_TEXT);
+  if (buffer_state->_type == GUMBO_NODE_WHITESPACE &&
+      parser->_options->drop_whitespace) {
+    gumbo_string_buffer_clear(parser, &buffer_state->_buffer);
+    return;
+  }
   GumboNode* text_node = create_node(parser, buffer_state->_type);
   GumboText* text_node_data = &text_node->v.text;
-  text_node_data->text = gumbo_string_buffer_to_string(
-      parser, &buffer_state->_buffer);
   text_node_data->original_text.data = buffer_state->_start_original_text;
   text_node_data->original_text.length =
       state->_current_token->original_text.data -
       buffer_state->_start_original_text;
+  if (parser->_options->zero_copy_text &&
+      text_node_data->original_text.length == buffer_state->_buffer.length &&
+      !memcmp(text_node_data->original_text.data, buffer_state->_buffer.data,
+              buffer_state->_buffer.length)) {
+    text_node_data->text = text_node_data->original_text.data;
+  } else {
+    text_node_data->text = gumbo_string_buffer_to_string(
+        parser, &buffer_state->_buffer);
+  }
   text_node_data->start_pos = buffer_state->_start_position;
   if (state->_foster_parent_insertions && node_tag_in(
       get_current_node(parser), GUMBO_TAG_TABLE, GUMBO_TAG_TBODY,
@@ -847,10 +944,8 @@ static void maybe_flush_text_node_buffer(GumboParser* parser) {
   gumbo_debug("Flushing text node buffer of %.*s.\n",
              (int) buffer_state->_buffer.length, buffer_state->_buffer.data);
 
-  gumbo_string_buffer_destroy(parser, &buffer_state->_buffer);
-  gumbo_string_buffer_init(parser, &buffer_state->_buffer);
+  gumbo_string_buffer_clear(parser, &buffer_state->_buffer);
   buffer_state->_type = GUMBO_NODE_WHITESPACE;
-  assert(buffer_state->_buffer.length == 0);
 }
 
 static void record_end_of_element(
@@ -931,7 +1026,7 @@ void clear_stack_to_table_body_context(GumboParser* parser) {
 static GumboNode* create_element(GumboParser* parser, GumboTag tag) {
   GumboNode* node = create_node(parser, GUMBO_NODE_ELEMENT);
   GumboElement* element = &node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
+  init_inline_children(node);
   gumbo_vector_init(parser, 0, &element->attributes);
   element->tag = tag;
   element->tag_namespace = GUMBO_NAMESPACE_HTML;
@@ -950,7 +1045,7 @@ static GumboNode* create_element_from_token(
 
   GumboNode* node = create_node(parser, GUMBO_NODE_ELEMENT);
   GumboElement* element = &node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
+  init_inline_children(node);
   element->attributes = start_tag->attributes;
   element->tag = start_tag->tag;
   element->tag_namespace = tag_namespace;
@@ -989,17 +1084,21 @@ static void insert_element(GumboParser* parser, GumboNode* node,
       get_current_node(parser), GUMBO_TAG_TABLE, GUMBO_TAG_TBODY,
       GUMBO_TAG_TFOOT, GUMBO_TAG_THEAD, GUMBO_TAG_TR, GUMBO_TAG_LAST)) {
     foster_parent_element(parser, node);
-    gumbo_vector_add(parser, (void*) node, &state->_open_elements);
-    return;
+  } else {
+    // This is called to insert the root HTML element, but get_current_node
+    // assumes the stack of open elements is non-empty, so we need special
+    // handling for this case.
+    append_node(
+        parser, parser->_output->root ?
+        get_current_node(parser) : parser->_output->document, node);
   }
-
-  // This is called to insert the root HTML element, but get_current_node
-  // assumes the stack of open elements is non-empty, so we need special
-  // handling for this case.
-  append_node(
-      parser, parser->_output->root ?
-      get_current_node(parser) : parser->_output->document, node);
   gumbo_vector_add(parser, (void*) node, &state->_open_elements);
+
+  const GumboOptions* options = parser->_options;
+  if (options->stop_function &&
+      options->stop_function(options->userdata, node)) {
+    state->_stop_requested = true;
+  }
 }
 
 // Convenience method that combines create_element_from_token and
@@ -1170,7 +1269,8 @@ static bool is_open_element(GumboParser* parser, const GumboNode* node) {
 GumboNode* clone_node(
     GumboParser* parser, const GumboNode* node, GumboParseFlags reason) {
   assert(node->type == GUMBO_NODE_ELEMENT);
-  GumboNode* new_node = gumbo_parser_allocate(parser, sizeof(GumboNode));
+  GumboNode* new_node =
+      gumbo_parser_allocate(parser, node_allocation_size(node->type));
   *new_node = *node;
   new_node->parent = NULL;
   new_node->index_within_parent = -1;
@@ -1179,7 +1279,7 @@ GumboNode* clone_node(
   new_node->parse_flags &= ~GUMBO_INSERTION_IMPLICIT_END_TAG;
   new_node->parse_flags |= reason | GUMBO_INSERTION_BY_PARSER;
   GumboElement* element = &new_node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
+  init_inline_children(new_node);
 
   const GumboVector* old_attributes = &node->v.element.attributes;
   gumbo_vector_init(parser, old_attributes->length, &element->attributes);
@@ -1189,7 +1289,9 @@ GumboNode* clone_node(
         gumbo_parser_allocate(parser, sizeof(GumboAttribute));
     *attr = *old_attr;
     attr->name = gumbo_copy_stringz(parser, old_attr->name);
-    attr->value = gumbo_copy_stringz(parser, old_attr->value);
+    // Values left in the original buffer (see lazy_attribute_values) stay.
+    attr->value = old_attr->value ?
+        gumbo_copy_stringz(parser, old_attr->value) : NULL;
     gumbo_vector_add(parser, attr, &element->attributes);
   }
   return new_node;
@@ -1940,16 +2042,23 @@ static bool adoption_agency_algorithm(
         parser, formatting_node, GUMBO_INSERTION_ADOPTION_AGENCY_CLONED);
     formatting_node->parse_flags |= GUMBO_INSERTION_IMPLICIT_END_TAG;
 
-    // Step 12.  Instead of appending nodes one-by-one, we swap the children
-    // vector of furthest_block with the empty children of new_formatting_node,
-    // reducing memory traffic and allocations.  We still have to reset their
-    // parent pointers, though.
-    GumboVector temp = new_formatting_node->v.element.children;
-    new_formatting_node->v.element.children =
-        furthest_block->v.element.children;
-    furthest_block->v.element.children = temp;
+    // Step 12.  Instead of appending nodes one-by-one, we hand the children
+    // array of furthest_block over to new_formatting_node, reducing memory
+    // traffic and allocations.  An inline array can't change hands, but it's
+    // small enough to copy.  We still have to reset their parent pointers,
+    // though.
+    GumboVector* moved = &furthest_block->v.element.children;
+    assert(new_formatting_node->v.element.children.length == 0);
+    if (moved->data == inline_children(furthest_block)) {
+      memcpy(new_formatting_node->v.element.children.data, moved->data,
+             sizeof(void*) * moved->length);
+      new_formatting_node->v.element.children.length = moved->length;
+    } else {
+      new_formatting_node->v.element.children = *moved;
+    }
+    init_inline_children(furthest_block);
 
-    temp = new_formatting_node->v.element.children;
+    GumboVector temp = new_formatting_node->v.element.children;
     for (int i = 0; i < temp.length; ++i) {
       GumboNode* child = temp.data[i];
       child->parent = new_formatting_node;
@@ -2033,6 +2142,7 @@ static bool handle_initial(GumboParser* parser, GumboToken* token) {
     document->name = token->v.doc_type.name;
     document->public_identifier = token->v.doc_type.public_identifier;
     document->system_identifier = token->v.doc_type.system_identifier;
+    document->original_doctype = token->original_text;
     document->doc_type_quirks_mode = compute_quirks_mode(&token->v.doc_type);
     set_insertion_mode(parser, GUMBO_INSERTION_MODE_BEFORE_HTML);
     return maybe_add_doctype_error(parser, token);
@@ -2298,13 +2408,18 @@ static void destroy_node(GumboParser* parser, GumboNode* node) {
       for (int i = 0; i < node->v.element.children.length; ++i) {
         destroy_node(parser, node->v.element.children.data[i]);
       }
-      gumbo_parser_deallocate(parser, node->v.element.children.data);
+      if (node->v.element.children.data != inline_children(node)) {
+        gumbo_parser_deallocate(parser, node->v.element.children.data);
+      }
       break;
     case GUMBO_NODE_TEXT:
     case GUMBO_NODE_CDATA:
     case GUMBO_NODE_COMMENT:
     case GUMBO_NODE_WHITESPACE:
-      gumbo_parser_deallocate(parser, (void*) node->v.text.text);
+      // Slices of the original buffer (see zero_copy_text) aren't owned.
+      if (node->v.text.text != node->v.text.original_text.data) {
+        gumbo_parser_deallocate(parser, (void*) node->v.text.text);
+      }
       break;
   }
   gumbo_parser_deallocate(parser, node);
@@ -2745,11 +2860,10 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     text_state->_start_position = token->position;
     text_state->_type = GUMBO_NODE_TEXT;
     if (prompt_attr) {
-      int prompt_attr_length = strlen(prompt_attr->value);
-      gumbo_string_buffer_destroy(parser, &text_state->_buffer);
-      text_state->_buffer.data = gumbo_copy_stringz(parser, prompt_attr->value);
-      text_state->_buffer.length = prompt_attr_length;
-      text_state->_buffer.capacity = prompt_attr_length + 1;
+      GumboStringPiece prompt_text = gumbo_attribute_value_piece(prompt_attr);
+      gumbo_string_buffer_clear(parser, &text_state->_buffer);
+      gumbo_string_buffer_append_string(
+          parser, &prompt_text, &text_state->_buffer);
       gumbo_destroy_attribute(parser, prompt_attr);
     } else {
       GumboStringPiece prompt_text = GUMBO_STRING(
@@ -2786,6 +2900,7 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     name->name_end = kGumboEmptySourcePosition;
     name->value_start = kGumboEmptySourcePosition;
     name->value_end = kGumboEmptySourcePosition;
+    name->value_replaced = false;
     gumbo_vector_add(parser, name, &input->v.element.attributes);
 
     pop_current_node(parser);   // <input>
@@ -3805,48 +3920,87 @@ static bool handle_token(GumboParser* parser, GumboToken* token) {
   }
 }
 
+// Returns true if the insertion mode is one of those that build the document up
+// to and including the <head>.
+static bool is_head_insertion_mode(GumboInsertionMode mode) {
+  switch (mode) {
+    case GUMBO_INSERTION_MODE_INITIAL:
+    case GUMBO_INSERTION_MODE_BEFORE_HTML:
+    case GUMBO_INSERTION_MODE_BEFORE_HEAD:
+    case GUMBO_INSERTION_MODE_IN_HEAD:
+    case GUMBO_INSERTION_MODE_IN_HEAD_NOSCRIPT:
+    case GUMBO_INSERTION_MODE_AFTER_HEAD:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns true if the options ask for the parse to end now that the current
+// token has been handled.
+static bool should_stop_early(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  if (state->_stop_requested) {
+    return true;
+  }
+  if (!parser->_options->stop_after_head) {
+    return false;
+  }
+  // <template> can appear in the head and takes the parser through the body
+  // insertion modes while its contents are built.
+  if (state->_template_insertion_modes.length > 0) {
+    return false;
+  }
+  GumboInsertionMode mode = state->_insertion_mode;
+  if (mode == GUMBO_INSERTION_MODE_TEXT) {
+    mode = state->_original_insertion_mode;
+  }
+  return !is_head_insertion_mode(mode);
+}
+
 GumboOutput* gumbo_parse(const char* buffer) {
   return gumbo_parse_with_options(
       &kGumboDefaultOptions, buffer, strlen(buffer));
 }
 
-GumboOutput* gumbo_parse_with_options(
-    const GumboOptions* options, const char* buffer, size_t length) {
-  GumboParser parser;
-  parser._options = options;
-  output_init(&parser);
-  gumbo_tokenizer_state_init(&parser, buffer, length);
-  parser_state_init(&parser);
-
-  GumboParserState* state = parser._parser_state;
-  gumbo_debug("Parsing %.*s.\n", length, buffer);
+// Feeds tokens to the tree construction stage until the end of input, or until
+// the options ask for the parse to stop early.  Returns true when the parse is
+// over; false means the input is provisional and the next token can't be
+// lexed until more of it has been provided.  'token' holds the current token;
+// it's referenced by the parser state until finish_parse.
+static bool run_tree_construction(GumboParser* parser, GumboToken* token) {
+  GumboParserState* state = parser->_parser_state;
+  const GumboOptions* options = parser->_options;
 
   // Sanity check so that infinite loops die with an assertion failure instead
   // of hanging the process before we ever get an error.
   int loop_count = 0;
 
-  GumboToken token;
-  bool has_error = false;
   do {
     if (state->_reprocess_current_token) {
       state->_reprocess_current_token = false;
     } else {
-      GumboNode* current_node = get_current_node(&parser);
+      GumboNode* current_node = get_current_node(parser);
       gumbo_tokenizer_set_is_current_node_foreign(
-          &parser, current_node &&
+          parser, current_node &&
           current_node->v.element.tag_namespace != GUMBO_NAMESPACE_HTML);
-      has_error = !gumbo_lex(&parser, &token) || has_error;
+      bool needs_input;
+      bool lexed = gumbo_lex_provisional(parser, token, &needs_input);
+      if (needs_input) {
+        return false;
+      }
+      state->_has_error = !lexed || state->_has_error;
     }
     const char* token_type = "text";
-    switch (token.type) {
+    switch (token->type) {
       case GUMBO_TOKEN_DOCTYPE:
         token_type = "doctype";
         break;
       case GUMBO_TOKEN_START_TAG:
-        token_type = gumbo_normalized_tagname(token.v.start_tag.tag);
+        token_type = gumbo_normalized_tagname(token->v.start_tag.tag);
         break;
       case GUMBO_TOKEN_END_TAG:
-        token_type = gumbo_normalized_tagname(token.v.end_tag);
+        token_type = gumbo_normalized_tagname(token->v.end_tag);
         break;
       case GUMBO_TOKEN_COMMENT:
         token_type = "comment";
@@ -3855,24 +4009,24 @@ GumboOutput* gumbo_parse_with_options(
         break;
     }
     gumbo_debug("Handling %s token @%d:%d in state %d.\n",
-               (char*) token_type, token.position.line, token.position.column,
-               state->_insertion_mode);
+               (char*) token_type, token->position.line,
+               token->position.column, state->_insertion_mode);
 
-    state->_current_token = &token;
+    state->_current_token = token;
     state->_self_closing_flag_acknowledged =
-        !(token.type == GUMBO_TOKEN_START_TAG &&
-          token.v.start_tag.is_self_closing);
+        !(token->type == GUMBO_TOKEN_START_TAG &&
+          token->v.start_tag.is_self_closing);
 
-    has_error = !handle_token(&parser, &token) || has_error;
+    state->_has_error = !handle_token(parser, token) || state->_has_error;
 
     // Check for memory leaks when ownership is transferred from start tag
     // tokens to nodes.
     assert(state->_reprocess_current_token ||
-           token.type != GUMBO_TOKEN_START_TAG ||
-           token.v.start_tag.attributes.data == NULL);
+           token->type != GUMBO_TOKEN_START_TAG ||
+           token->v.start_tag.attributes.data == NULL);
 
     if (!state->_self_closing_flag_acknowledged) {
-      GumboError* error = add_parse_error(&parser, &token);
+      GumboError* error = add_parse_error(parser, token);
       if (error) {
         error->type = GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG;
       }
@@ -3881,26 +4035,198 @@ GumboOutput* gumbo_parse_with_options(
     ++loop_count;
     assert(loop_count < 1000000000);
 
-  } while ((token.type != GUMBO_TOKEN_EOF || state->_reprocess_current_token) &&
-           !(options->stop_on_first_error && has_error));
+    if (should_stop_early(parser)) {
+      // The token that moved us on may be waiting to be reprocessed in the
+      // new insertion mode; it's dropped, so release what it owns.
+      if (state->_reprocess_current_token) {
+        gumbo_token_destroy(parser, token);
+      }
+      return true;
+    }
+  } while ((token->type != GUMBO_TOKEN_EOF ||
+            state->_reprocess_current_token) &&
+           !(options->stop_on_first_error && state->_has_error));
+  return true;
+}
 
-  finish_parsing(&parser);
+// Closes whatever is still open and puts the finishing touches on the output.
+static void complete_output(GumboParser* parser) {
+  finish_parsing(parser);
   // For API uniformity reasons, if the doctype still has nulls, convert them to
   // empty strings.
-  GumboDocument* doc_type = &parser._output->document->v.document;
+  GumboDocument* doc_type = &parser->_output->document->v.document;
   if (doc_type->name == NULL) {
-    doc_type->name = gumbo_copy_stringz(&parser, "");
+    doc_type->name = gumbo_copy_stringz(parser, "");
   }
   if (doc_type->public_identifier == NULL) {
-    doc_type->public_identifier = gumbo_copy_stringz(&parser, "");
+    doc_type->public_identifier = gumbo_copy_stringz(parser, "");
   }
   if (doc_type->system_identifier == NULL) {
-    doc_type->system_identifier = gumbo_copy_stringz(&parser, "");
+    doc_type->system_identifier = gumbo_copy_stringz(parser, "");
+  }
+}
+
+// Completes the output, releases the parser and tokenizer state and returns the
+// output.
+static GumboOutput* finish_parse(GumboParser* parser) {
+  complete_output(parser);
+  parser_state_destroy(parser);
+  gumbo_tokenizer_state_destroy(parser);
+  return parser->_output;
+}
+
+GumboOutput* gumbo_parse_with_options(
+    const GumboOptions* options, const char* buffer, size_t length) {
+  GumboParser parser;
+  parser._options = options;
+  output_init(&parser);
+  gumbo_tokenizer_state_init(&parser, buffer, length);
+  parser_state_init(&parser);
+  gumbo_debug("Parsing %.*s.\n", length, buffer);
+
+  GumboToken token;
+  run_tree_construction(&parser, &token);
+  return finish_parse(&parser);
+}
+
+GumboOutput* gumbo_parse_head(
+    const GumboOptions* options, const char* buffer, size_t length) {
+  GumboOptions head_options = *options;
+  head_options.stop_after_head = true;
+  return gumbo_parse_with_options(&head_options, buffer, length);
+}
+
+struct GumboInternalPushParser {
+  // Copy of the options passed to gumbo_parser_create.
+  GumboOptions _options;
+
+  // The parse in progress; its tokenizer reads from _buffer.  The parser and
+  // tokenizer state live as long as the GumboPushParser and are reset for
+  // every document.
+  GumboParser _parser;
+  GumboToken _token;
+
+  // The input received so far.  The tree points into this, so it can't move
+  // while a parse is in progress.
+  char* _buffer;
+  size_t _length;
+  size_t _capacity;
+
+  // Set once the tree construction stage is over: end of input or early stop.
+  bool _done;
+
+  // Set once gumbo_parser_finish has handed out the output.
+  bool _finished;
+};
+
+// Starts a parse over all of the input received so far.
+static void start_push_parse(GumboPushParser* push) {
+  GumboParser* parser = &push->_parser;
+  output_init(parser);
+  gumbo_tokenizer_state_reset(parser, push->_buffer, 0);
+  parser_state_reset(parser);
+  gumbo_tokenizer_extend_input(parser, push->_buffer + push->_length, false);
+  push->_done = run_tree_construction(parser, &push->_token);
+}
+
+// Throws away a parse in progress, tree included.
+static void abandon_push_parse(GumboPushParser* push) {
+  GumboParser* parser = &push->_parser;
+  gumbo_destroy_output(parser->_options, parser->_output);
+}
+
+GumboPushParser* gumbo_parser_create(
+    const GumboOptions* options, size_t expected_length) {
+  GumboParser allocator;
+  allocator._options = options;
+  GumboPushParser* push =
+      gumbo_parser_allocate(&allocator, sizeof(GumboPushParser));
+  push->_options = *options;
+  GumboParser* parser = &push->_parser;
+  parser->_options = &push->_options;
+  push->_capacity = expected_length > 0 ? expected_length : 4096;
+  push->_buffer = gumbo_parser_allocate(parser, push->_capacity);
+  push->_length = 0;
+  push->_finished = false;
+  gumbo_tokenizer_state_init(parser, push->_buffer, 0);
+  parser_state_init(parser);
+  start_push_parse(push);
+  return push;
+}
+
+void gumbo_parser_reset(GumboPushParser* push, size_t expected_length) {
+  GumboParser* parser = &push->_parser;
+  if (!push->_finished) {
+    abandon_push_parse(push);
+  }
+  if (expected_length > push->_capacity) {
+    // Nothing in the buffer is needed any more, so there's no point in copying
+    // it over.
+    gumbo_parser_deallocate(parser, push->_buffer);
+    push->_capacity = expected_length;
+    push->_buffer = gumbo_parser_allocate(parser, push->_capacity);
   }
+  push->_length = 0;
+  push->_finished = false;
+  start_push_parse(push);
+}
 
-  parser_state_destroy(&parser);
-  gumbo_tokenizer_state_destroy(&parser);
-  return parser._output;
+bool gumbo_parser_feed(
+    GumboPushParser* push, const char* chunk, size_t length) {
+  assert(!push->_finished);
+  if (push->_done) {
+    return false;
+  }
+  GumboParser* parser = &push->_parser;
+  if (push->_length + length <= push->_capacity) {
+    memcpy(push->_buffer + push->_length, chunk, length);
+    push->_length += length;
+    gumbo_tokenizer_extend_input(parser, push->_buffer + push->_length, false);
+    push->_done = run_tree_construction(parser, &push->_token);
+    return !push->_done;
+  }
+
+  // The buffer has to move, and everything parsed so far points into it.
+  size_t capacity = push->_capacity * 2;
+  while (capacity < push->_length + length) {
+    capacity *= 2;
+  }
+  char* buffer = gumbo_parser_allocate(parser, capacity);
+  memcpy(buffer, push->_buffer, push->_length);
+  memcpy(buffer + push->_length, chunk, length);
+  abandon_push_parse(push);
+  gumbo_parser_deallocate(parser, push->_buffer);
+  push->_buffer = buffer;
+  push->_length += length;
+  push->_capacity = capacity;
+  start_push_parse(push);
+  return !push->_done;
+}
+
+GumboOutput* gumbo_parser_finish(GumboPushParser* push) {
+  assert(!push->_finished);
+  GumboParser* parser = &push->_parser;
+  if (!push->_done) {
+    gumbo_tokenizer_extend_input(parser, push->_buffer + push->_length, true);
+    push->_done = run_tree_construction(parser, &push->_token);
+    assert(push->_done);
+  }
+  push->_finished = true;
+  complete_output(parser);
+  return parser->_output;
+}
+
+void gumbo_parser_destroy(GumboPushParser* push) {
+  GumboParser* parser = &push->_parser;
+  if (!push->_finished) {
+    abandon_push_parse(push);
+  }
+  parser_state_destroy(parser);
+  gumbo_tokenizer_state_destroy(parser);
+  GumboParser allocator;
+  allocator._options = &push->_options;
+  gumbo_parser_deallocate(&allocator, push->_buffer);
+  gumbo_parser_deallocate(&allocator, push);
 }
 
 void gumbo_destroy_node(GumboOptions* options, GumboNode* node) {
@@ -0,0 +1,381 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Serialization of a parse tree back to HTML; see gumbo_serialize.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#include "gumbo.h"
+#include "parser.h"
+#include "util.h"
+
+static const size_t kDefaultHtmlBufferSize = 4096;
+
+// State threaded through a gumbo_serialize run.
+typedef struct {
+  GumboParser* parser;
+  GumboHtmlBuffer* output;
+
+  // The last span copied from the source, or NULLs.
+  const char* source_start;
+  const char* source_end;
+} SerializerState;
+
+static void append(
+    SerializerState* state, const char* data, size_t length) {
+  GumboParser* parser = state->parser;
+  GumboHtmlBuffer* output = state->output;
+  if (output->length + length > output->capacity) {
+    size_t capacity =
+        output->capacity ? output->capacity * 2 : kDefaultHtmlBufferSize;
+    while (capacity < output->length + length) {
+      capacity *= 2;
+    }
+    if (output->data) {
+      output->data = gumbo_parser_reallocate(
+          parser, output->data, output->capacity, capacity);
+    } else {
+      output->data = gumbo_parser_allocate(parser, capacity);
+    }
+    output->capacity = capacity;
+  }
+  memcpy(output->data + output->length, data, length);
+  output->length += length;
+}
+
+static void append_string(SerializerState* state, const char* str) {
+  append(state, str, strlen(str));
+}
+
+static bool is_whitespace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+// Returns the end of the </body> or </html> tag at 'text', or NULL if there's
+// none.  Those two never close anything by themselves, so the parser keeps no
+// trace of them.
+static const char* skip_body_or_html_end_tag(
+    const char* text, const char* end) {
+  if (end - text < 7 || text[0] != '<' || text[1] != '/' ||
+      (strncasecmp(text + 2, "body", 4) && strncasecmp(text + 2, "html", 4))) {
+    return NULL;
+  }
+  for (text += 6; text < end && is_whitespace(*text); ++text) {
+  }
+  return text < end && *text == '>' ? text + 1 : NULL;
+}
+
+// Appends a span of the source.  What the parser dropped between this span and
+// the previous one, if it's nothing but whitespace (say, around <head>, or the
+// \r of a \r\n) and </body> and </html> tags, is copied along so that the
+// source is reproduced more closely.  A span within the previous one has been
+// copied already: text after </body> ends up in the body, with the end tags
+// that follow the body in its text node or the gap before it.
+static void append_source(
+    SerializerState* state, const char* data, size_t length) {
+  if (data >= state->source_start && data + length <= state->source_end) {
+    return;
+  }
+  const char* start = data;
+  const char* gap = state->source_end;
+  if (gap && gap < data) {
+    while (gap < data) {
+      if (is_whitespace(*gap)) {
+        ++gap;
+      } else if ((gap = skip_body_or_html_end_tag(gap, data)) == NULL) {
+        break;
+      }
+    }
+    if (gap == data) {
+      start = state->source_end;
+    }
+  }
+  append(state, start, data + length - start);
+  state->source_start = start;
+  state->source_end = data + length;
+}
+
+// Appends text with the characters that are special in it escaped: & and " in
+// attribute values, &, < and > elsewhere.
+static void append_escaped(
+    SerializerState* state, const char* text, size_t length,
+    bool in_attribute) {
+  const char* run = text;
+  for (const char* c = text; c < text + length; ++c) {
+    const char* escape = NULL;
+    switch (*c) {
+      case '&':
+        escape = "&amp;";
+        break;
+      case '"':
+        escape = in_attribute ? "&quot;" : NULL;
+        break;
+      case '<':
+        escape = in_attribute ? NULL : "&lt;";
+        break;
+      case '>':
+        escape = in_attribute ? NULL : "&gt;";
+        break;
+      default:
+        break;
+    }
+    if (escape) {
+      append(state, run, c - run);
+      append_string(state, escape);
+      run = c + 1;
+    }
+  }
+  append(state, run, text + length - run);
+}
+
+// Appends a double-quoted attribute value.
+static void append_quoted(
+    SerializerState* state, const char* value, size_t length) {
+  append(state, "\"", 1);
+  append_escaped(state, value, length, true);
+  append(state, "\"", 1);
+}
+
+static void append_quoted_string(SerializerState* state, const char* value) {
+  append_quoted(state, value, strlen(value));
+}
+
+// Appends the doctype as it was written, so that what follows it in the source
+// is copied along as any other gap; it's only rebuilt from its fields for a
+// document that wasn't parsed from a buffer.
+static void append_doctype(
+    SerializerState* state, const GumboDocument* document) {
+  if (document->original_doctype.length > 0) {
+    append_source(state, document->original_doctype.data,
+                  document->original_doctype.length);
+    return;
+  }
+  append_string(state, "<!DOCTYPE ");
+  append_string(state, document->name);
+  if (*document->public_identifier) {
+    append_string(state, " PUBLIC ");
+    append_quoted_string(state, document->public_identifier);
+    if (*document->system_identifier) {
+      append(state, " ", 1);
+      append_quoted_string(state, document->system_identifier);
+    }
+  } else if (*document->system_identifier) {
+    append_string(state, " SYSTEM ");
+    append_quoted_string(state, document->system_identifier);
+  }
+  append(state, ">", 1);
+}
+
+// Returns whether the attribute was parsed from the start tag itself.  Those
+// copied over from other tags (like a second <html>) or made up by the parser
+// aren't part of its text.
+static bool is_in_tag(
+    const GumboAttribute* attr, const GumboStringPiece* original_tag) {
+  return attr->original_name.data >= original_tag->data &&
+      attr->original_name.data < original_tag->data + original_tag->length;
+}
+
+static void append_start_tag(
+    SerializerState* state, const GumboElement* element) {
+  const GumboStringPiece* tag = &element->original_tag;
+  if (tag->length == 0) {
+    // Implied by the parser, and would be again.
+    return;
+  }
+  const char* tag_end = tag->data + tag->length;
+  const char* close = tag_end[-1] == '>' ? tag_end - 1 : tag_end;
+  const GumboVector* attributes = &element->attributes;
+
+  // Splice replaced values into the original text.  Attributes come in source
+  // order.
+  const char* copied = tag->data;
+  bool has_extra_attributes = false;
+  for (int i = 0; i < attributes->length; ++i) {
+    const GumboAttribute* attr = attributes->data[i];
+    if (!is_in_tag(attr, tag)) {
+      has_extra_attributes = true;
+      continue;
+    }
+    if (!attr->value_replaced) {
+      continue;
+    }
+    const GumboStringPiece* original_value = &attr->original_value;
+    if (original_value->data == attr->original_name.data) {
+      // The attribute had no value; add one after the name.
+      const char* name_end =
+          attr->original_name.data + attr->original_name.length;
+      append_source(state, copied, name_end - copied);
+      append(state, "=", 1);
+      copied = name_end;
+    } else {
+      append_source(state, copied, original_value->data - copied);
+      copied = original_value->data + original_value->length;
+    }
+    append_quoted_string(state, attr->value);
+    state->source_start = copied;
+    state->source_end = copied;
+  }
+  append_source(state, copied, close - copied);
+
+  if (has_extra_attributes) {
+    for (int i = 0; i < attributes->length; ++i) {
+      const GumboAttribute* attr = attributes->data[i];
+      if (!is_in_tag(attr, tag)) {
+        append(state, " ", 1);
+        append_string(state, attr->name);
+        append(state, "=", 1);
+        GumboStringPiece value = gumbo_attribute_value_piece(attr);
+        append_quoted(state, value.data, value.length);
+      }
+    }
+  }
+  append_source(state, close, tag_end - close);
+}
+
+static void append_end_tag(SerializerState* state, const GumboNode* node) {
+  const GumboElement* element = &node->v.element;
+  // End tags that closed other elements as well are recorded for all of them,
+  // but only belong to the one they name.  The others were closed implicitly,
+  // and will be again.
+  if (node->parse_flags & GUMBO_INSERTION_IMPLICIT_END_TAG ||
+      element->original_end_tag.length == 0) {
+    return;
+  }
+  // Whatever follows </body> or </html> in the source is moved into the body,
+  // so the end tags come out once all of it has, if it hasn't already taken
+  // them along.
+  if ((element->tag == GUMBO_TAG_BODY || element->tag == GUMBO_TAG_HTML) &&
+      element->original_end_tag.data < state->source_end) {
+    return;
+  }
+  append_source(state, element->original_end_tag.data,
+                element->original_end_tag.length);
+}
+
+static void append_text(SerializerState* state, const GumboNode* node) {
+  const GumboText* text = &node->v.text;
+  if (text->original_text.length > 0) {
+    append_source(state, text->original_text.data, text->original_text.length);
+    return;
+  }
+  // Made up by the parser.
+  switch (node->type) {
+    case GUMBO_NODE_COMMENT:
+      append_string(state, "<!--");
+      append_string(state, text->text);
+      append_string(state, "-->");
+      break;
+    case GUMBO_NODE_CDATA:
+      append_string(state, "<![CDATA[");
+      append_string(state, text->text);
+      append_string(state, "]]>");
+      break;
+    default:
+      append_escaped(state, text->text, strlen(text->text), false);
+      break;
+  }
+}
+
+static const GumboVector* children_of(const GumboNode* node) {
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      return &node->v.document.children;
+    case GUMBO_NODE_ELEMENT:
+      return &node->v.element.children;
+    default:
+      return NULL;
+  }
+}
+
+// Writes out whatever comes before the node's children.
+static void open_node(SerializerState* state, const GumboNode* node) {
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      if (node->v.document.has_doctype) {
+        append_doctype(state, &node->v.document);
+      }
+      break;
+    case GUMBO_NODE_ELEMENT:
+      append_start_tag(state, &node->v.element);
+      break;
+    default:
+      append_text(state, node);
+      break;
+  }
+}
+
+// Writes out whatever comes after the node's children.
+static void close_node(SerializerState* state, const GumboNode* node) {
+  if (node->type == GUMBO_NODE_ELEMENT) {
+    append_end_tag(state, node);
+  }
+}
+
+void gumbo_serialize(
+    const GumboOptions* options, const GumboNode* root,
+    GumboHtmlBuffer* output) {
+  GumboParser parser;
+  parser._options = options;
+  SerializerState state;
+  state.parser = &parser;
+  state.output = output;
+  state.source_start = NULL;
+  state.source_end = NULL;
+
+  // Walk the tree without recursing, so that deeply nested documents can't
+  // exhaust the stack.
+  const GumboNode* node = root;
+  while (true) {
+    open_node(&state, node);
+    const GumboVector* children = children_of(node);
+    if (children && children->length > 0) {
+      node = children->data[0];
+      continue;
+    }
+    // Close the node, and the ancestors it's the last descendant of.
+    while (true) {
+      close_node(&state, node);
+      if (node == root) {
+        return;
+      }
+      const GumboVector* siblings = children_of(node->parent);
+      if (node->index_within_parent + 1 < siblings->length) {
+        node = siblings->data[node->index_within_parent + 1];
+        break;
+      }
+      node = node->parent;
+    }
+  }
+}
+
+void gumbo_destroy_html_buffer(
+    const GumboOptions* options, GumboHtmlBuffer* buffer) {
+  GumboParser parser;
+  parser._options = options;
+  gumbo_parser_deallocate(&parser, buffer->data);
+  buffer->data = NULL;
+  buffer->length = 0;
+  buffer->capacity = 0;
+}
+
+void gumbo_attribute_set_value(
+    const GumboOptions* options, GumboAttribute* attribute, const char* value) {
+  GumboParser parser;
+  parser._options = options;
+  gumbo_parser_deallocate(&parser, (void*) attribute->value);
+  attribute->value = gumbo_copy_stringz(&parser, value);
+  attribute->value_replaced = true;
+}
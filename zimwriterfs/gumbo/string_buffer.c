@@ -32,24 +32,28 @@ static void maybe_resize_string_buffer(
     struct GumboInternalParser* parser, size_t additional_chars,
     GumboStringBuffer* buffer) {
   size_t new_length = buffer->length + additional_chars;
-  size_t new_capacity = buffer->capacity;
+  size_t new_capacity =
+      buffer->capacity ? buffer->capacity : kDefaultStringBufferSize;
   while (new_capacity < new_length) {
     new_capacity *= 2;
   }
   if (new_capacity != buffer->capacity) {
-    char* new_data = gumbo_parser_allocate(parser, new_capacity);
-    memcpy(new_data, buffer->data, buffer->length);
-    gumbo_parser_deallocate(parser, buffer->data);
-    buffer->data = new_data;
+    if (buffer->data) {
+      buffer->data = gumbo_parser_reallocate(
+          parser, buffer->data, buffer->capacity, new_capacity);
+    } else {
+      buffer->data = gumbo_parser_allocate(parser, new_capacity);
+    }
     buffer->capacity = new_capacity;
   }
 }
 
 void gumbo_string_buffer_init(
     struct GumboInternalParser* parser, GumboStringBuffer* output) {
-  output->data = gumbo_parser_allocate(parser, kDefaultStringBufferSize);
+  // Storage is allocated on the first append; many buffers never get one.
+  output->data = NULL;
   output->length = 0;
-  output->capacity = kDefaultStringBufferSize;
+  output->capacity = 0;
 }
 
 void gumbo_string_buffer_reserve(
@@ -92,10 +96,17 @@ void gumbo_string_buffer_append_string(
   output->length += str->length;
 }
 
+void gumbo_string_buffer_clear(
+    struct GumboInternalParser* parser, GumboStringBuffer* input) {
+  input->length = 0;
+}
+
 char* gumbo_string_buffer_to_string(
     struct GumboInternalParser* parser, GumboStringBuffer* input) {
   char* buffer = gumbo_parser_allocate(parser, input->length + 1);
-  memcpy(buffer, input->data, input->length);
+  if (input->length > 0) {
+    memcpy(buffer, input->data, input->length);
+  }
   buffer[input->length] = '\0';
   return buffer;
 }
@@ -34,7 +34,8 @@ struct GumboInternalParser;
 // it needs to be.  Note that the internal buffer here is *not* nul-terminated,
 // so be sure not to use ordinary string manipulation functions on it.
 typedef struct {
-  // A pointer to the beginning of the string.  NULL iff length == 0.
+  // A pointer to the beginning of the string.  NULL until something has been
+  // appended or reserved.
   char* data;
 
   // The length of the string fragment, in bytes.  May be zero.
@@ -66,6 +67,10 @@ void gumbo_string_buffer_append_string(
     struct GumboInternalParser* parser, GumboStringPiece* str,
     GumboStringBuffer* output);
 
+// Empties the GumboStringBuffer, keeping its storage for reuse.
+void gumbo_string_buffer_clear(
+    struct GumboInternalParser* parser, GumboStringBuffer* input);
+
 // Converts this string buffer to const char*, alloctaing a new buffer for it.
 char* gumbo_string_buffer_to_string(
     struct GumboInternalParser* parser, GumboStringBuffer* input);
@@ -193,6 +193,12 @@ typedef struct GumboInternalTokenizerState {
 
   // The UTF8Iterator over the tokenizer input.
   Utf8Iterator _input;
+
+  // Copies of _temporary_buffer and _script_data_buffer taken by
+  // gumbo_lex_provisional, kept so that the storage can be reused for every
+  // token.
+  GumboStringBuffer _saved_temporary_buffer;
+  GumboStringBuffer _saved_script_data_buffer;
 } GumboTokenizerState;
 
 // Adds an ERR_UNEXPECTED_CODE_POINT parse error to the parser's error struct.
@@ -348,12 +354,10 @@ static void clear_temporary_buffer(GumboParser* parser) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   assert(!tokenizer->_temporary_buffer_emit);
   utf8iterator_mark(&tokenizer->_input);
-  gumbo_string_buffer_destroy(parser, &tokenizer->_temporary_buffer);
-  gumbo_string_buffer_init(parser, &tokenizer->_temporary_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_temporary_buffer);
   // The temporary buffer and script data buffer are the same object in the
   // spec, so the script data buffer should be cleared as well.
-  gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
-  gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_script_data_buffer);
 }
 
 // Appends a codepoint to the temporary buffer.
@@ -547,7 +551,6 @@ static StateResult emit_current_tag(GumboParser* parser, GumboToken* output) {
     gumbo_debug("Emitted end tag %s.\n",
                gumbo_normalized_tagname(tag_state->_tag));
   }
-  gumbo_string_buffer_destroy(parser, &tag_state->_buffer);
   finish_token(parser, output);
   gumbo_debug("Original text = %.*s.\n", output->original_text.length, output->original_text.data);
   assert(output->original_text.length >= 2);
@@ -567,7 +570,6 @@ static void abandon_current_tag(GumboParser* parser) {
   }
   gumbo_parser_deallocate(parser, tag_state->_attributes.data);
   mark_tag_state_as_empty(tag_state);
-  gumbo_string_buffer_destroy(parser, &tag_state->_buffer);
   gumbo_debug("Abandoning current tag.\n");
 }
 
@@ -664,12 +666,13 @@ static void append_char_to_tag_buffer(GumboParser* parser, int codepoint,
 }
 
 // (Re-)initialize the tag buffer.  This also resets the original_text pointer
-// and _start_pos field to point to the current position.
+// and _start_pos field to point to the current position.  The buffer's storage
+// lives as long as the tokenizer and is reused for every name and value.
 static void initialize_tag_buffer(GumboParser* parser) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   GumboTagState* tag_state = &tokenizer->_tag_state;
 
-  gumbo_string_buffer_init(parser, &tag_state->_buffer);
+  gumbo_string_buffer_clear(parser, &tag_state->_buffer);
   reset_tag_buffer_start_point(parser);
 }
 
@@ -688,7 +691,8 @@ static void start_new_tag(GumboParser* parser, bool is_start_tag) {
   gumbo_string_buffer_append_codepoint(parser, c, &tag_state->_buffer);
 
   assert(tag_state->_attributes.data == NULL);
-  gumbo_vector_init(parser, 4, &tag_state->_attributes);
+  // Most tags have no attributes; the vector allocates on the first one.
+  gumbo_vector_init(parser, 0, &tag_state->_attributes);
   tag_state->_drop_next_attr_value = false;
   tag_state->_is_start_tag = is_start_tag;
   tag_state->_is_self_closing = false;
@@ -729,10 +733,8 @@ static void copy_over_original_tag_text(
   utf8iterator_get_position(&tokenizer->_input, end_pos);
 }
 
-// Releases and then re-initializes the tag buffer.
+// Empties the tag buffer for the next name or value.
 static void reinitialize_tag_buffer(GumboParser* parser) {
-  gumbo_parser_deallocate(
-      parser, parser->_tokenizer_state->_tag_state._buffer.data);
   initialize_tag_buffer(parser);
 }
 
@@ -742,18 +744,20 @@ static void finish_tag_name(GumboParser* parser) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   GumboTagState* tag_state = &tokenizer->_tag_state;
 
-  const char* temp;
-  copy_over_tag_buffer(parser, &temp);
-  tag_state->_tag = gumbo_tag_enum(temp);
+  // Null terminate the buffer in place rather than copying it out.
+  gumbo_string_buffer_append_codepoint(parser, '\0', &tag_state->_buffer);
+  tag_state->_tag = gumbo_tag_enum(tag_state->_buffer.data);
   reinitialize_tag_buffer(parser);
-  gumbo_parser_deallocate(parser, (void*) temp);
 }
 
 // Adds an ERR_DUPLICATE_ATTR parse error to the parser's error struct.
+// The name is taken out of the tag buffer either way, so that it doesn't run
+// into the next one when no error is recorded (lean parses, max_errors).
 static void add_duplicate_attr_error(GumboParser* parser, const char* attr_name,
                                      int original_index, int new_index) {
   GumboError* error = gumbo_add_error(parser);
   if (!error) {
+    reinitialize_tag_buffer(parser);
     return;
   }
   GumboTagState* tag_state = &parser->_tokenizer_state->_tag_state;
@@ -777,8 +781,6 @@ static bool finish_attribute_name(GumboParser* parser) {
   GumboTagState* tag_state = &tokenizer->_tag_state;
   // May've been set by a previous attribute without a value; reset it here.
   tag_state->_drop_next_attr_value = false;
-  assert(tag_state->_attributes.data);
-  assert(tag_state->_attributes.capacity);
 
   GumboVector* /* GumboAttribute* */ attributes = &tag_state->_attributes;
   for (int i = 0; i < attributes->length; ++i) {
@@ -799,31 +801,55 @@ static bool finish_attribute_name(GumboParser* parser) {
   copy_over_tag_buffer(parser, &attr->name);
   copy_over_original_tag_text(parser, &attr->original_name,
                               &attr->name_start, &attr->name_end);
-  attr->value = gumbo_copy_stringz(parser, "");
+  // An empty value is a verbatim copy of nothing, for lazy_attribute_values.
+  attr->value = parser->_options->lazy_attribute_values ?
+      NULL : gumbo_copy_stringz(parser, "");
   copy_over_original_tag_text(parser, &attr->original_value,
                               &attr->name_start, &attr->name_end);
+  // Until a value comes along, it's an empty one right after the name.
+  attr->value_start = attr->name_end;
+  attr->value_end = attr->name_end;
+  attr->value_replaced = false;
   gumbo_vector_add(parser, attr, attributes);
   reinitialize_tag_buffer(parser);
   return true;
 }
 
+// Returns whether the decoded value of an attribute, so far only in the tag
+// buffer, is the same as the text it was decoded from.
+static bool value_is_verbatim(
+    const GumboStringBuffer* buffer, const GumboAttribute* attr) {
+  GumboStringPiece original = gumbo_attribute_value_piece(attr);
+  return original.length == buffer->length &&
+      (buffer->length == 0 ||
+       memcmp(original.data, buffer->data, buffer->length) == 0);
+}
+
 // Finishes an attribute value.  This sets the value of the most recently added
 // attribute to the current contents of the tag buffer.
 static void finish_attribute_value(GumboParser* parser) {
   GumboTagState* tag_state = &parser->_tokenizer_state->_tag_state;
   if (tag_state->_drop_next_attr_value) {
     // Duplicate attribute name detected in an earlier state, so we have to
-    // ignore the value.
+    // ignore the value, and empty the buffer it was read into.
     tag_state->_drop_next_attr_value = false;
+    reinitialize_tag_buffer(parser);
     return;
   }
 
   GumboAttribute* attr =
       tag_state->_attributes.data[tag_state->_attributes.length - 1];
   gumbo_parser_deallocate(parser, (void*) attr->value);
-  copy_over_tag_buffer(parser, &attr->value);
+  attr->value = NULL;
   copy_over_original_tag_text(parser, &attr->original_value,
                               &attr->value_start, &attr->value_end);
+  // With lazy_attribute_values, the value stays in the original buffer if it
+  // reads the same there.  Those that had to be decoded are copied now, while
+  // the decoded text is at hand.
+  if (!parser->_options->lazy_attribute_values ||
+      !value_is_verbatim(&tag_state->_buffer, attr)) {
+    copy_over_tag_buffer(parser, &attr->value);
+  }
   reinitialize_tag_buffer(parser);
 }
 
@@ -845,18 +871,30 @@ void gumbo_tokenizer_state_init(
   GumboTokenizerState* tokenizer =
       gumbo_parser_allocate(parser, sizeof(GumboTokenizerState));
   parser->_tokenizer_state = tokenizer;
+  gumbo_string_buffer_init(parser, &tokenizer->_temporary_buffer);
+  gumbo_string_buffer_init(parser, &tokenizer->_tag_state._buffer);
+  gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_init(parser, &tokenizer->_saved_temporary_buffer);
+  gumbo_string_buffer_init(parser, &tokenizer->_saved_script_data_buffer);
+  gumbo_tokenizer_state_reset(parser, text, text_length);
+}
+
+void gumbo_tokenizer_state_reset(
+    GumboParser* parser, const char* text, size_t text_length) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   gumbo_tokenizer_set_state(parser, GUMBO_LEX_DATA);
   tokenizer->_reconsume_current_input = false;
   tokenizer->_is_current_node_foreign = false;
   tokenizer->_tag_state._last_start_tag = GUMBO_TAG_LAST;
 
   tokenizer->_buffered_emit_char = kGumboNoChar;
-  gumbo_string_buffer_init(parser, &tokenizer->_temporary_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_temporary_buffer);
   tokenizer->_temporary_buffer_emit = NULL;
 
   mark_tag_state_as_empty(&tokenizer->_tag_state);
+  gumbo_string_buffer_clear(parser, &tokenizer->_tag_state._buffer);
 
-  gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_script_data_buffer);
   tokenizer->_token_start = text;
   utf8iterator_init(parser, text, text_length, &tokenizer->_input);
   utf8iterator_get_position(&tokenizer->_input, &tokenizer->_token_start_pos);
@@ -870,6 +908,9 @@ void gumbo_tokenizer_state_destroy(GumboParser* parser) {
   assert(tokenizer->_doc_type_state.system_identifier == NULL);
   gumbo_string_buffer_destroy(parser, &tokenizer->_temporary_buffer);
   gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_destroy(parser, &tokenizer->_tag_state._buffer);
+  gumbo_string_buffer_destroy(parser, &tokenizer->_saved_temporary_buffer);
+  gumbo_string_buffer_destroy(parser, &tokenizer->_saved_script_data_buffer);
   gumbo_parser_deallocate(parser, tokenizer);
 }
 
@@ -1586,8 +1627,7 @@ static StateResult handle_script_double_escaped_lt_state(
     int c, GumboToken* output) {
   if (c == '/') {
     gumbo_tokenizer_set_state(parser, GUMBO_LEX_SCRIPT_DOUBLE_ESCAPED_END);
-    gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
-    gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+    gumbo_string_buffer_clear(parser, &tokenizer->_script_data_buffer);
     return emit_current_char(parser, output);
   } else {
     gumbo_tokenizer_set_state(parser, GUMBO_LEX_SCRIPT_DOUBLE_ESCAPED);
@@ -2947,6 +2987,77 @@ bool gumbo_lex(GumboParser* parser, GumboToken* output) {
   }
 }
 
+void gumbo_tokenizer_extend_input(
+    GumboParser* parser, const char* end, bool is_final) {
+  utf8iterator_extend(&parser->_tokenizer_state->_input, end, is_final);
+}
+
+// Replaces the contents of 'to' with those of 'from'.
+static void copy_string_buffer(
+    GumboParser* parser, const GumboStringBuffer* from, GumboStringBuffer* to) {
+  to->length = 0;
+  if (from->length > 0) {
+    gumbo_string_buffer_reserve(parser, from->length, to);
+    memcpy(to->data, from->data, from->length);
+    to->length = from->length;
+  }
+}
+
+bool gumbo_lex_provisional(
+    GumboParser* parser, GumboToken* output, bool* needs_input) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  *needs_input = false;
+  if (tokenizer->_input._is_final) {
+    return gumbo_lex(parser, output);
+  }
+
+  // Between tokens, everything the tokenizer owns is in these two buffers; the
+  // tag and doctype states are only live while a token is being built, though
+  // the tag buffer's storage is kept around (and may have moved).
+  size_t emit_offset = tokenizer->_temporary_buffer_emit ?
+      tokenizer->_temporary_buffer_emit - tokenizer->_temporary_buffer.data : 0;
+  copy_string_buffer(parser, &tokenizer->_temporary_buffer,
+                     &tokenizer->_saved_temporary_buffer);
+  copy_string_buffer(parser, &tokenizer->_script_data_buffer,
+                     &tokenizer->_saved_script_data_buffer);
+  GumboTokenizerState saved = *tokenizer;
+  unsigned int saved_error_count = parser->_output->errors.length;
+
+  tokenizer->_input._needs_input = false;
+  bool result = gumbo_lex(parser, output);
+  if (!tokenizer->_input._needs_input) {
+    return result;
+  }
+
+  // The token may depend on input we haven't seen; undo everything.
+  *needs_input = true;
+  gumbo_token_destroy(parser, output);
+  GumboVector* errors = &parser->_output->errors;
+  while (errors->length > saved_error_count) {
+    gumbo_error_destroy(parser, gumbo_vector_pop(parser, errors));
+  }
+  // A doctype cut short right after its public identifier is left behind
+  // rather than emitted; its strings were allocated during this call.
+  GumboTokenDocType* doc_type = &tokenizer->_doc_type_state;
+  if (doc_type->name != saved._doc_type_state.name) {
+    gumbo_parser_deallocate(parser, (void*) doc_type->name);
+    gumbo_parser_deallocate(parser, (void*) doc_type->public_identifier);
+    gumbo_parser_deallocate(parser, (void*) doc_type->system_identifier);
+  }
+  copy_string_buffer(parser, &tokenizer->_saved_temporary_buffer,
+                     &tokenizer->_temporary_buffer);
+  copy_string_buffer(parser, &tokenizer->_saved_script_data_buffer,
+                     &tokenizer->_script_data_buffer);
+  saved._temporary_buffer = tokenizer->_temporary_buffer;
+  saved._script_data_buffer = tokenizer->_script_data_buffer;
+  saved._tag_state._buffer = tokenizer->_tag_state._buffer;
+  if (saved._temporary_buffer_emit) {
+    saved._temporary_buffer_emit = saved._temporary_buffer.data + emit_offset;
+  }
+  *tokenizer = saved;
+  return true;
+}
+
 void gumbo_token_destroy(GumboParser* parser, GumboToken* token) {
   if (!token) return;
 
@@ -74,6 +74,11 @@ typedef struct GumboInternalToken {
 void gumbo_tokenizer_state_init(
     struct GumboInternalParser* parser, const char* text, size_t text_length);
 
+// Sets up a parse of new text with the tokenizer state of a finished parse,
+// keeping the buffers it has already allocated.
+void gumbo_tokenizer_state_reset(
+    struct GumboInternalParser* parser, const char* text, size_t text_length);
+
 // Destroys the tokenizer state within the GumboParser object, freeing any
 // dynamically-allocated structures within it.
 void gumbo_tokenizer_state_destroy(struct GumboInternalParser* parser);
@@ -106,6 +111,19 @@ void gumbo_tokenizer_set_is_current_node_foreign(
 //   gumbo_tokenizer_state_destroy(&parser);
 bool gumbo_lex(struct GumboInternalParser* parser, GumboToken* output);
 
+// Makes the input passed to gumbo_tokenizer_state_init available up to 'end'.
+// Until this is called with is_final set, the input is provisional and must be
+// lexed with gumbo_lex_provisional.
+void gumbo_tokenizer_extend_input(
+    struct GumboInternalParser* parser, const char* end, bool is_final);
+
+// Like gumbo_lex, but for provisional input.  If the next token can't be told
+// apart from the end of input without seeing more of it, the tokenizer is put
+// back exactly as it was before the call (including the parser's error list),
+// *needs_input is set and the output token must be ignored.
+bool gumbo_lex_provisional(
+    struct GumboInternalParser* parser, GumboToken* output, bool* needs_input);
+
 // Frees the internally-allocated pointers within an GumboToken.  Note that this
 // doesn't free the token itself, since oftentimes it will be allocated on the
 // stack.  A simple call to free() (or GumboParser->deallocator, if
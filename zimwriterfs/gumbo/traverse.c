@@ -0,0 +1,50 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Stackless walks over a parse tree; see gumbo_next_node.
+
+#include <stddef.h>
+
+#include "gumbo.h"
+
+// Returns the children of an element or document node, or NULL for nodes that
+// can't have any.
+static const GumboVector* children_of(const GumboNode* node) {
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      return &node->v.document.children;
+    case GUMBO_NODE_ELEMENT:
+      return &node->v.element.children;
+    default:
+      return NULL;
+  }
+}
+
+GumboNode* gumbo_next_node(const GumboNode* root, const GumboNode* node) {
+  const GumboVector* children = children_of(node);
+  if (children && children->length > 0) {
+    return children->data[0];
+  }
+  return gumbo_next_node_skipping_children(root, node);
+}
+
+GumboNode* gumbo_next_node_skipping_children(
+    const GumboNode* root, const GumboNode* node) {
+  // Up to the first ancestor with a next sibling.
+  for (; node != root && node->parent; node = node->parent) {
+    const GumboVector* siblings = children_of(node->parent);
+    if (node->index_within_parent + 1 < siblings->length) {
+      return siblings->data[node->index_within_parent + 1];
+    }
+  }
+  return NULL;
+}
@@ -58,11 +58,77 @@ static void add_error(Utf8Iterator* iter, GumboErrorType type) {
   error->v.codepoint = code_point;
 }
 
+// This is the special handling for carriage returns that is mandated by the
+// HTML5 spec.  Since we're looking for particular 7-bit literal characters,
+// we operate in terms of chars and only need a check for iter overrun,
+// instead of having to read in a full next code point.  Returns the code point
+// that should become current.
+// http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#preprocessing-the-input-stream
+static int fold_carriage_return(Utf8Iterator* iter, int code_point) {
+  if (code_point == '\r') {
+    const char* next = iter->_start + iter->_width;
+    if (next < iter->_end && *next == '\n') {
+      // Advance the iter, as if the carriage return didn't exist.
+      ++iter->_start;
+      // Preserve the true offset, since other tools that look at it may be
+      // unaware of HTML5's rules for converting \r into \n.
+      ++iter->_pos.offset;
+    }
+    code_point = '\n';
+  }
+  return code_point;
+}
+
+// Reads the next character of an input that passed utf8_is_valid.  Every
+// sequence is known to be complete and well-formed and every code point is
+// acceptable, so all that's left is assembling the code point.
+static void read_valid_char(Utf8Iterator* iter) {
+  const unsigned char* c = (const unsigned char*) iter->_start;
+  int code_point;
+  if (c[0] < 0x80) {
+    iter->_width = 1;
+    code_point = c[0];
+  } else if (c[0] < 0xE0) {
+    iter->_width = 2;
+    code_point = ((c[0] & 0x1F) << 6) | (c[1] & 0x3F);
+  } else if (c[0] < 0xF0) {
+    iter->_width = 3;
+    code_point = ((c[0] & 0xF) << 12) | ((c[1] & 0x3F) << 6) | (c[2] & 0x3F);
+  } else {
+    iter->_width = 4;
+    code_point = ((c[0] & 0x7) << 18) | ((c[1] & 0x3F) << 12) |
+        ((c[2] & 0x3F) << 6) | (c[3] & 0x3F);
+  }
+  iter->_current = fold_carriage_return(iter, code_point);
+}
+
+// Returns whether the buffer holds enough bytes to decide what the character
+// at iter->_start is.  A carriage return depends on the byte after it, and
+// any other character on as many bytes as its lead byte announces.
+static bool is_complete_char(const Utf8Iterator* iter) {
+  unsigned char c = (unsigned char) *iter->_start;
+  size_t width = c == '\r' ? 2 : c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 :
+      c < 0xF5 ? 4 : c < 0xF8 ? 5 : c < 0xFC ? 6 : c < 0xFE ? 7 : 1;
+  return iter->_start + width <= iter->_end;
+}
+
 // Reads the next UTF-8 character in the iter.
 // This assumes that iter->_start points to the beginning of the character.
 // When this method returns, iter->_width and iter->_current will be set
 // appropriately, as well as any error flags.
 static void read_char(Utf8Iterator* iter) {
+  if (!iter->_is_final && !is_complete_char(iter)) {
+    // Stand in for the end of input until the rest of the character arrives.
+    iter->_current = -1;
+    iter->_width = 0;
+    iter->_needs_input = true;
+    return;
+  }
+  if (iter->_is_valid) {
+    read_valid_char(iter);
+    return;
+  }
+
   unsigned char c;
   unsigned char mask = '\0';
   int is_bad_char = false;
@@ -147,30 +213,16 @@ static void read_char(Utf8Iterator* iter) {
     code_point = kUtf8ReplacementChar;
   }
 
-  // This is the special handling for carriage returns that is mandated by the
-  // HTML5 spec.  Since we're looking for particular 7-bit literal characters,
-  // we operate in terms of chars and only need a check for iter overrun,
-  // instead of having to read in a full next code point.
-  // http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#preprocessing-the-input-stream
-  if (code_point == '\r') {
-    const char* next = iter->_start + iter->_width;
-    if (next < iter->_end && *next == '\n') {
-      // Advance the iter, as if the carriage return didn't exist.
-      ++iter->_start;
-      // Preserve the true offset, since other tools that look at it may be
-      // unaware of HTML5's rules for converting \r into \n.
-      ++iter->_pos.offset;
-    }
-    code_point = '\n';
-  }
-
   // At this point, we know we have a valid character as the code point, so we
   // set it, and we're done.
-  iter->_current = code_point;
+  iter->_current = fold_carriage_return(iter, code_point);
 }
 
 static void update_position(Utf8Iterator* iter) {
   iter->_pos.offset += iter->_width;
+  if (iter->_offsets_only) {
+    return;
+  }
   if (iter->_current == '\n') {
     ++iter->_pos.line;
     iter->_pos.column = 1;
@@ -190,16 +242,102 @@ bool utf8_is_invalid_code_point(int c) {
       ((c & 0xFFFF) == 0xFFFE) || ((c & 0xFFFF) == 0xFFFF);
 }
 
+// Word-at-a-time helpers for utf8_is_valid.  Both are exact as long as every
+// byte of the word is below 0x80: has_zero_byte(x) is nonzero iff some byte of
+// x is zero, and has_byte_below(x, n) iff some byte of x is below n.
+static const uint64_t kLowBits = 0x0101010101010101ULL;
+static const uint64_t kHighBits = 0x8080808080808080ULL;
+
+static uint64_t has_zero_byte(uint64_t x) {
+  return (x - kLowBits) & ~x & kHighBits;
+}
+
+static uint64_t has_byte_below(uint64_t x, unsigned char n) {
+  return (x - kLowBits * n) & ~x & kHighBits;
+}
+
+bool utf8_is_valid(const char* source, size_t source_length) {
+  const unsigned char* c = (const unsigned char*) source;
+  const unsigned char* end = c + source_length;
+  while (c < end) {
+    // Skip eight bytes of printable ASCII at once.  Anything else in the word
+    // (non-ASCII, controls, whitespace other than the space itself) sends
+    // those eight bytes through the full per-character check below.
+    const unsigned char* stop = end;
+    if (end - c >= 8) {
+      uint64_t word;
+      memcpy(&word, c, sizeof(word));
+      if (!(word & kHighBits) && !has_byte_below(word, 0x20) &&
+          !has_zero_byte(word ^ (kLowBits * 0x7F))) {
+        c += 8;
+        continue;
+      }
+      stop = c + 8;
+    }
+    while (c < stop) {
+      int code_point;
+      if (c[0] < 0x80) {
+        if (utf8_is_invalid_code_point(c[0])) {
+          return false;
+        }
+        ++c;
+      } else if (c[0] < 0xC2) {
+        // Stray continuation byte or overlong two-byte lead.
+        return false;
+      } else if (c[0] < 0xE0) {
+        // U+0080..U+07FF; the C1 controls up to U+009F are rejected.
+        if (end - c < 2 || (c[1] & 0xC0) != 0x80 ||
+            (c[0] == 0xC2 && c[1] <= 0x9F)) {
+          return false;
+        }
+        c += 2;
+      } else if (c[0] < 0xF0) {
+        if (end - c < 3 || (c[1] & 0xC0) != 0x80 || (c[2] & 0xC0) != 0x80) {
+          return false;
+        }
+        code_point =
+            ((c[0] & 0xF) << 12) | ((c[1] & 0x3F) << 6) | (c[2] & 0x3F);
+        if (code_point < 0x800 ||
+            (code_point >= 0xD800 && code_point <= 0xDFFF) ||
+            (code_point >= 0xFDD0 && code_point <= 0xFDEF) ||
+            code_point >= 0xFFFE) {
+          return false;
+        }
+        c += 3;
+      } else if (c[0] < 0xF5) {
+        if (end - c < 4 || (c[1] & 0xC0) != 0x80 ||
+            (c[2] & 0xC0) != 0x80 || (c[3] & 0xC0) != 0x80) {
+          return false;
+        }
+        code_point = ((c[0] & 0x7) << 18) | ((c[1] & 0x3F) << 12) |
+            ((c[2] & 0x3F) << 6) | (c[3] & 0x3F);
+        if (code_point < 0x10000 || code_point > 0x10FFFF ||
+            (code_point & 0xFFFE) == 0xFFFE) {
+          return false;
+        }
+        c += 4;
+      } else {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 void utf8iterator_init(
     GumboParser* parser, const char* source, size_t source_length,
     Utf8Iterator* iter) {
   iter->_start = source;
   iter->_end = source + source_length;
+  iter->_is_final = true;
+  iter->_needs_input = false;
   iter->_width = 0;
-  iter->_pos.line = 1;
-  iter->_pos.column = 1;
+  iter->_offsets_only = parser->_options->lean;
+  iter->_pos.line = iter->_offsets_only ? 0 : 1;
+  iter->_pos.column = iter->_offsets_only ? 0 : 1;
   iter->_pos.offset = 0;
   iter->_parser = parser;
+  iter->_is_valid = utf8_is_valid(source, source_length);
   if (source_length) {
     read_char(iter);
   } else {
@@ -207,6 +345,36 @@ void utf8iterator_init(
   }
 }
 
+// Returns the length of the longest prefix of the buffer that doesn't end in
+// the middle of a UTF-8 sequence.
+static size_t complete_prefix_length(const char* source, size_t length) {
+  const unsigned char* end = (const unsigned char*) source + length;
+  for (size_t i = 1; i <= 3 && i <= length; ++i) {
+    unsigned char c = end[-i];
+    if ((c & 0xC0) == 0x80) {
+      continue;  // Continuation byte; keep looking for the lead.
+    }
+    size_t width = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    return width > i ? length - i : length;
+  }
+  return length;
+}
+
+void utf8iterator_extend(Utf8Iterator* iter, const char* end, bool is_final) {
+  assert(end >= iter->_end);
+  const char* old_end = iter->_end;
+  iter->_is_final = is_final;
+  if (!is_final) {
+    end = old_end + complete_prefix_length(old_end, end - old_end);
+  }
+  iter->_end = end;
+  iter->_is_valid = iter->_is_valid && utf8_is_valid(old_end, end - old_end);
+  // The current character may have been a stand-in for the end of input.
+  if (iter->_current == -1 && iter->_start < end) {
+    read_char(iter);
+  }
+}
+
 void utf8iterator_next(Utf8Iterator* iter) {
   iter->_start += iter->_width;
   // We update positions based on the *last* character read, so that the first
@@ -216,6 +384,11 @@ void utf8iterator_next(Utf8Iterator* iter) {
     read_char(iter);
   } else {  // EOF
     iter->_current = -1;
+    // Stay put on subsequent calls instead of walking past the buffer end.
+    iter->_width = 0;
+    if (!iter->_is_final) {
+      iter->_needs_input = true;
+    }
   }
 }
 
@@ -235,6 +408,9 @@ const char* utf8iterator_get_char_pointer(const Utf8Iterator* iter) {
 bool utf8iterator_maybe_consume_match(
     Utf8Iterator* iter, const char* prefix, size_t length,
     bool case_sensitive) {
+  if (iter->_start + length > iter->_end && !iter->_is_final) {
+    iter->_needs_input = true;
+  }
   bool matched = (iter->_start + length <= iter->_end) && (case_sensitive ?
       !strncmp(iter->_start, prefix, length) :
       !strncasecmp(iter->_start, prefix, length));
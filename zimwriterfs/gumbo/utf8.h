@@ -58,6 +58,16 @@ typedef struct GumboInternalUtf8Iterator {
   // Points past the end of the iter, like a past-the-end iterator in the STL.
   const char* _end;
 
+  // False while more input may still be appended with utf8iterator_extend.
+  // _end then doesn't split well-formed characters, and anything that would
+  // look at or past it sets _needs_input instead of relying on the end of
+  // input.
+  bool _is_final;
+
+  // Set when the iterator ran into the end of provisional input; see
+  // utf8iterator_extend.  Cleared only by the caller.
+  bool _needs_input;
+
   // The code point under the cursor.
   int _current;
 
@@ -70,6 +80,14 @@ typedef struct GumboInternalUtf8Iterator {
   // The SourcePosition for the mark.
   GumboSourcePosition _mark_pos;
 
+  // True if the whole input passed utf8_is_valid when the iterator was
+  // initialized (or extended).  Decoding then can't produce any error, so
+  // read_char takes a lean path that skips the per-character error checks.
+  bool _is_valid;
+
+  // Copy of GumboOptions.lean: only the byte offset of _pos is maintained.
+  bool _offsets_only;
+
   // Pointer back to the GumboParser instance, for configuration options and
   // error recording.
   struct GumboInternalParser* _parser;
@@ -79,12 +97,25 @@ typedef struct GumboInternalUtf8Iterator {
 // forbidden by the HTML5 spec, such as NUL bytes and undefined control chars.
 bool utf8_is_invalid_code_point(int c);
 
+// Returns true if the buffer is well-formed UTF-8 (RFC 3629: no overlong forms,
+// surrogates or code points above U+10FFFF) and contains none of the code
+// points rejected by utf8_is_invalid_code_point.  Decoding such a buffer never
+// records an error.  Runs of plain ASCII are checked a machine word at a time.
+bool utf8_is_valid(const char* source, size_t source_length);
+
 // Initializes a new Utf8Iterator from the given byte buffer.  The source does
 // not have to be NUL-terminated, but the length must be passed in explicitly.
 void utf8iterator_init(
     struct GumboInternalParser* parser, const char* source,
     size_t source_length, Utf8Iterator* iter);
 
+// Makes the source buffer passed to utf8iterator_init visible up to 'end',
+// which must not be before the previous end.  Until this is called with
+// is_final set, the input is provisional: a character split by 'end' is held
+// back, and reaching the end or peeking past it sets _needs_input, so that the
+// caller can discard what was read and retry once more input is available.
+void utf8iterator_extend(Utf8Iterator* iter, const char* end, bool is_final);
+
 // Advances the current position by one code point.
 void utf8iterator_next(Utf8Iterator* iter);
 
@@ -39,6 +39,23 @@ void gumbo_parser_deallocate(GumboParser* parser, void* ptr) {
   return parser->_options->deallocator(parser->_options->userdata, ptr);
 }
 
+void* gumbo_parser_reallocate(
+    GumboParser* parser, void* ptr, size_t old_num_bytes, size_t num_bytes) {
+  const GumboOptions* options = parser->_options;
+  if (options->reallocator) {
+    return options->reallocator(
+        options->userdata, ptr, old_num_bytes, num_bytes);
+  }
+  if (options->allocator == kGumboDefaultOptions.allocator &&
+      options->deallocator == kGumboDefaultOptions.deallocator) {
+    return realloc(ptr, num_bytes);
+  }
+  void* new_ptr = gumbo_parser_allocate(parser, num_bytes);
+  memcpy(new_ptr, ptr, old_num_bytes < num_bytes ? old_num_bytes : num_bytes);
+  gumbo_parser_deallocate(parser, ptr);
+  return new_ptr;
+}
+
 char* gumbo_copy_stringz(GumboParser* parser, const char* str) {
   char* buffer = gumbo_parser_allocate(parser, strlen(str) + 1);
   strcpy(buffer, str);
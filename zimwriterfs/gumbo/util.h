@@ -47,6 +47,12 @@ void* gumbo_parser_allocate(
 // config options.
 void gumbo_parser_deallocate(struct GumboInternalParser* parser, void* ptr);
 
+// Grow (or shrink) a chunk of memory obtained from gumbo_parser_allocate, using
+// the reallocator specified in the Parser's config options if there is one.
+void* gumbo_parser_reallocate(
+    struct GumboInternalParser* parser, void* ptr, size_t old_num_bytes,
+    size_t num_bytes);
+
 // Debug wrapper for printf, to make it easier to turn off debugging info when
 // required.
 void gumbo_debug(const char* format, ...);
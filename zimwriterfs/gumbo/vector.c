@@ -52,10 +52,8 @@ static void enlarge_vector_if_full(
       size_t old_num_bytes = sizeof(void*) * vector->capacity;
       vector->capacity *= 2;
       size_t num_bytes = sizeof(void*) * vector->capacity;
-      void** temp = gumbo_parser_allocate(parser, num_bytes);
-      memcpy(temp, vector->data, old_num_bytes);
-      gumbo_parser_deallocate(parser, vector->data);
-      vector->data = temp;
+      vector->data = gumbo_parser_reallocate(
+          parser, vector->data, old_num_bytes, num_bytes);
     } else {
       // 0-capacity vector; no previous array to deallocate.
       vector->capacity = 2;
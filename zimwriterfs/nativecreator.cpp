@@ -0,0 +1,946 @@
+#include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <queue>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <lzma.h>
+
+#include "nativecreator.h"
+#include "recordsorter.h"
+
+#define ZIM_MAGIC_NUMBER 72173914
+#define ZIM_MAJOR_VERSION 5
+#define ZIM_MINOR_VERSION 0
+#define ZIM_HEADER_SIZE 80
+#define ZIM_NO_PAGE 0xffffffff
+#define ZIM_REDIRECT_MIME_TYPE 0xffff
+#define ZIM_COMPRESSION_NONE 1
+#define ZIM_COMPRESSION_LZMA 4
+
+/* Same preset as the LZMA stream of zimlib */
+#define LZMA_CLUSTER_PRESET (3 | LZMA_PRESET_EXTREME)
+
+static const size_t outputBufferSize = 1024 * 1024;
+
+static inline double getTime() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+/* MD5 (RFC 1321), for the checksum which ends the ZIM file */
+typedef struct {
+  uint32_t state[4];
+  uint64_t length;
+  unsigned char buffer[64];
+} Md5Context;
+
+static const uint32_t md5Sines[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const unsigned int md5Shifts[16] = {
+  7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+static void md5Init(Md5Context &context) {
+  context.state[0] = 0x67452301;
+  context.state[1] = 0xefcdab89;
+  context.state[2] = 0x98badcfe;
+  context.state[3] = 0x10325476;
+  context.length = 0;
+}
+
+static void md5Block(Md5Context &context, const unsigned char *block) {
+  uint32_t words[16];
+  for (unsigned int i = 0; i < 16; i++) {
+    words[i] = block[i*4] | (block[i*4+1] << 8) | (block[i*4+2] << 16) | ((uint32_t)block[i*4+3] << 24);
+  }
+
+  uint32_t a = context.state[0];
+  uint32_t b = context.state[1];
+  uint32_t c = context.state[2];
+  uint32_t d = context.state[3];
+  for (unsigned int i = 0; i < 64; i++) {
+    uint32_t f;
+    unsigned int g;
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+    uint32_t sum = a + f + md5Sines[i] + words[g];
+    unsigned int shift = md5Shifts[(i / 16) * 4 + i % 4];
+    a = d;
+    d = c;
+    c = b;
+    b = b + ((sum << shift) | (sum >> (32 - shift)));
+  }
+  context.state[0] += a;
+  context.state[1] += b;
+  context.state[2] += c;
+  context.state[3] += d;
+}
+
+static void md5Update(Md5Context &context, const char *data, size_t size) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t used = context.length % 64;
+  context.length += size;
+
+  if (used > 0) {
+    size_t count = std::min(64 - used, size);
+    memcpy(context.buffer + used, bytes, count);
+    bytes += count;
+    size -= count;
+    if (used + count < 64) {
+      return;
+    }
+    md5Block(context, context.buffer);
+  }
+  while (size >= 64) {
+    md5Block(context, bytes);
+    bytes += 64;
+    size -= 64;
+  }
+  memcpy(context.buffer, bytes, size);
+}
+
+static void md5Final(Md5Context &context, unsigned char digest[16]) {
+  uint64_t bits = context.length * 8;
+  char padding[64];
+  memset(padding, 0, sizeof(padding));
+  padding[0] = (char)0x80;
+  size_t used = context.length % 64;
+  md5Update(context, padding, used < 56 ? 56 - used : 120 - used);
+
+  char lengthBytes[8];
+  for (unsigned int i = 0; i < 8; i++) {
+    lengthBytes[i] = (char)(bits >> (8 * i));
+  }
+  md5Update(context, lengthBytes, 8);
+
+  for (unsigned int i = 0; i < 16; i++) {
+    digest[i] = (unsigned char)(context.state[i / 4] >> (8 * (i % 4)));
+  }
+}
+
+/* Little-endian integers, as all those of the format */
+static void appendUint16(std::string &buffer, uint16_t value) {
+  buffer += (char)(value & 0xff);
+  buffer += (char)(value >> 8);
+}
+
+static void appendUint32(std::string &buffer, uint32_t value) {
+  for (unsigned int i = 0; i < 4; i++) {
+    buffer += (char)((value >> (8 * i)) & 0xff);
+  }
+}
+
+static void appendUint64(std::string &buffer, uint64_t value) {
+  for (unsigned int i = 0; i < 8; i++) {
+    buffer += (char)((value >> (8 * i)) & 0xff);
+  }
+}
+
+static void appendUint32BE(std::string &buffer, uint32_t value) {
+  for (unsigned int i = 0; i < 4; i++) {
+    buffer += (char)((value >> (8 * (3 - i))) & 0xff);
+  }
+}
+
+static uint16_t readUint16(const char *data) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+  return bytes[0] | (bytes[1] << 8);
+}
+
+static uint32_t readUint32(const char *data) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint32_t readUint32BE(const char *data) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+  return ((uint32_t)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+/* Directory entry of an article or a redirect; cluster is the number
+   of its cluster in opening order until the clusters are written */
+typedef struct {
+  char ns;
+  std::string url;
+  std::string title;
+  std::string aid;
+  std::string redirectAid;
+  uint16_t mimeType;
+  uint32_t cluster;
+  uint32_t blob;
+} Dirent;
+
+inline bool isRedirect(const Dirent &dirent) {
+  return dirent.mimeType == ZIM_REDIRECT_MIME_TYPE;
+}
+
+inline size_t getDirentSize(const Dirent &dirent) {
+  return (isRedirect(dirent) ? 12 : 16) + dirent.url.size() + 1 + dirent.title.size() + 1;
+}
+
+/* The directory is sorted as records, byte strings compared byte by
+   byte: the sort key comes first, its strings ended by a NUL (which
+   URLs, titles and article ids can't contain) and its numbers big-endian,
+   then the rest of the record.
+
+   Dirents sort by namespace, URL and arrival number, so that the first
+   of two articles with the same URL is the one kept */
+static void encodeDirent(const Dirent &dirent, uint32_t number, std::string &record) {
+  record.clear();
+  record += dirent.ns;
+  record.append(dirent.url.c_str(), dirent.url.size() + 1);
+  appendUint32BE(record, number);
+  appendUint16(record, dirent.mimeType);
+  appendUint32(record, dirent.cluster);
+  appendUint32(record, dirent.blob);
+  record.append(dirent.title.c_str(), dirent.title.size() + 1);
+  record.append(dirent.aid.c_str(), dirent.aid.size() + 1);
+  record.append(dirent.redirectAid.c_str(), dirent.redirectAid.size() + 1);
+}
+
+static void decodeDirent(const std::string &record, Dirent &dirent) {
+  const char *field = record.data();
+  dirent.ns = *field++;
+  dirent.url = field;
+  field += dirent.url.size() + 5;
+  dirent.mimeType = readUint16(field);
+  dirent.cluster = readUint32(field + 2);
+  dirent.blob = readUint32(field + 6);
+  field += 10;
+  dirent.title = field;
+  field += dirent.title.size() + 1;
+  dirent.aid = field;
+  field += dirent.aid.size() + 1;
+  dirent.redirectAid = field;
+}
+
+/* A cluster, from the time it's filled to the time it's written */
+typedef struct {
+  uint32_t number;
+  uint32_t openNumber;
+  bool isCompressed;
+  std::vector<uint32_t> blobOffsets;
+  std::string data;
+
+  /* As it goes in the file: compression byte, then blob offsets and
+     blobs, compressed or not */
+  std::string output;
+} Cluster;
+
+/* Clusters go from the thread filling them to the compressing ones,
+   then through the reorder buffer to the thread writing them out in
+   number order to the temporary file */
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t clusterClosed;
+  pthread_cond_t clusterCompressed;
+  pthread_cond_t clusterWritten;
+  std::queue<Cluster*> closedClusters;
+  std::map<uint32_t, Cluster*> compressedClusters;
+  unsigned int pendingCount;
+  unsigned int maxPendingCount;
+  uint32_t clusterCount;
+  bool isClosing;
+
+  FILE *file;
+  std::string path;
+  std::vector<uint64_t> clusterOffsets;
+  uint64_t size;
+  uint64_t dataSize;
+  std::string error;
+} ClusterPipeline;
+
+static bool compressData(const std::string &input, std::string &output) {
+  lzma_stream stream = LZMA_STREAM_INIT;
+  if (lzma_easy_encoder(&stream, LZMA_CLUSTER_PRESET, LZMA_CHECK_CRC32) != LZMA_OK) {
+    return false;
+  }
+
+  size_t start = output.size();
+  output.resize(start + lzma_stream_buffer_bound(input.size()));
+  stream.next_in = reinterpret_cast<const uint8_t*>(input.data());
+  stream.avail_in = input.size();
+  stream.next_out = reinterpret_cast<uint8_t*>(&output[start]);
+  stream.avail_out = output.size() - start;
+  lzma_ret ret = lzma_code(&stream, LZMA_FINISH);
+  output.resize(output.size() - stream.avail_out);
+  lzma_end(&stream);
+  return ret == LZMA_STREAM_END;
+}
+
+static bool serializeCluster(Cluster &cluster) {
+  uint32_t offsetsSize = 4 * (cluster.blobOffsets.size() + 1);
+  std::string blobs;
+  blobs.reserve(offsetsSize + cluster.data.size());
+  for (size_t i = 0; i < cluster.blobOffsets.size(); i++) {
+    appendUint32(blobs, offsetsSize + cluster.blobOffsets[i]);
+  }
+  appendUint32(blobs, offsetsSize + cluster.data.size());
+  blobs += cluster.data;
+  std::string().swap(cluster.data);
+
+  if (cluster.isCompressed) {
+    cluster.output = (char)ZIM_COMPRESSION_LZMA;
+    return compressData(blobs, cluster.output);
+  }
+  cluster.output = (char)ZIM_COMPRESSION_NONE;
+  cluster.output += blobs;
+  return true;
+}
+
+static void *compressClusters(void *arg) {
+  ClusterPipeline *pipeline = static_cast<ClusterPipeline*>(arg);
+
+  while (true) {
+    pthread_mutex_lock(&pipeline->mutex);
+    while (pipeline->closedClusters.empty() && !pipeline->isClosing) {
+      pthread_cond_wait(&pipeline->clusterClosed, &pipeline->mutex);
+    }
+    if (pipeline->closedClusters.empty()) {
+      pthread_mutex_unlock(&pipeline->mutex);
+      break;
+    }
+    Cluster *cluster = pipeline->closedClusters.front();
+    pipeline->closedClusters.pop();
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    bool isSerialized = serializeCluster(*cluster);
+
+    pthread_mutex_lock(&pipeline->mutex);
+    if (!isSerialized) {
+      pipeline->error = "Unable to compress a cluster";
+    }
+    pipeline->compressedClusters[cluster->number] = cluster;
+    pthread_cond_signal(&pipeline->clusterCompressed);
+    pthread_mutex_unlock(&pipeline->mutex);
+  }
+  return NULL;
+}
+
+static void *writeClusters(void *arg) {
+  ClusterPipeline *pipeline = static_cast<ClusterPipeline*>(arg);
+  uint32_t number = 0;
+
+  while (true) {
+    pthread_mutex_lock(&pipeline->mutex);
+    std::map<uint32_t, Cluster*>::iterator found;
+    while ((found = pipeline->compressedClusters.find(number)) == pipeline->compressedClusters.end() &&
+	   !(pipeline->isClosing && number == pipeline->clusterCount)) {
+      pthread_cond_wait(&pipeline->clusterCompressed, &pipeline->mutex);
+    }
+    if (found == pipeline->compressedClusters.end()) {
+      pthread_mutex_unlock(&pipeline->mutex);
+      break;
+    }
+    Cluster *cluster = found->second;
+    pipeline->compressedClusters.erase(found);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    pipeline->clusterOffsets.push_back(pipeline->size);
+    pipeline->size += cluster->output.size();
+    bool isWritten = fwrite(cluster->output.data(), 1, cluster->output.size(), pipeline->file) == cluster->output.size();
+    delete(cluster);
+
+    pthread_mutex_lock(&pipeline->mutex);
+    if (!isWritten) {
+      pipeline->error = "Unable to write to " + pipeline->path;
+    }
+    pipeline->pendingCount--;
+    pthread_cond_signal(&pipeline->clusterWritten);
+    pthread_mutex_unlock(&pipeline->mutex);
+    number++;
+  }
+  return NULL;
+}
+
+/* Hand a full cluster over to the compressing threads, once there is
+   room for it; its number goes to clusterNumbers, for its articles */
+static void closeCluster(ClusterPipeline &pipeline, Cluster *cluster, std::vector<uint32_t> &clusterNumbers) {
+  pthread_mutex_lock(&pipeline.mutex);
+  while (pipeline.pendingCount >= pipeline.maxPendingCount) {
+    pthread_cond_wait(&pipeline.clusterWritten, &pipeline.mutex);
+  }
+  cluster->number = pipeline.clusterCount++;
+  clusterNumbers[cluster->openNumber] = cluster->number;
+  pipeline.dataSize += cluster->data.size();
+  pipeline.pendingCount++;
+  pipeline.closedClusters.push(cluster);
+  pthread_cond_signal(&pipeline.clusterClosed);
+  pthread_mutex_unlock(&pipeline.mutex);
+}
+
+/* Let the threads write out the clusters handed over to them, then
+   wait for them to be done */
+static void closePipeline(ClusterPipeline &pipeline, std::vector<pthread_t> &compressors, pthread_t writer) {
+  pthread_mutex_lock(&pipeline.mutex);
+  pipeline.isClosing = true;
+  pthread_cond_broadcast(&pipeline.clusterClosed);
+  pthread_cond_broadcast(&pipeline.clusterCompressed);
+  pthread_mutex_unlock(&pipeline.mutex);
+  for (unsigned int i = 0; i < compressors.size(); i++) {
+    pthread_join(compressors[i], NULL);
+  }
+  pthread_join(writer, NULL);
+  pthread_mutex_destroy(&pipeline.mutex);
+  pthread_cond_destroy(&pipeline.clusterClosed);
+  pthread_cond_destroy(&pipeline.clusterCompressed);
+  pthread_cond_destroy(&pipeline.clusterWritten);
+}
+
+/* The ZIM file being written, with the MD5 of what has been so far */
+typedef struct {
+  FILE *file;
+  std::string path;
+  std::string buffer;
+  Md5Context md5;
+} OutputFile;
+
+static void flushOutput(OutputFile &output) {
+  md5Update(output.md5, output.buffer.data(), output.buffer.size());
+  if (fwrite(output.buffer.data(), 1, output.buffer.size(), output.file) != output.buffer.size()) {
+    throw std::runtime_error("Unable to write to " + output.path);
+  }
+  output.buffer.clear();
+}
+
+static void writeOutput(OutputFile &output, const char *data, size_t size) {
+  output.buffer.append(data, size);
+  if (output.buffer.size() >= outputBufferSize) {
+    flushOutput(output);
+  }
+}
+
+/* Files of create() past the clusters: unless it gets to the end,
+   they are closed and removed as it exits, the ZIM file being only
+   renamed to its final path once complete */
+class PendingFiles {
+  public:
+    FILE *direntFile;
+    FILE *outputFile;
+    std::string outputPath;
+    std::string clusterPath;
+
+    PendingFiles() : direntFile(NULL), outputFile(NULL) {}
+    ~PendingFiles() {
+      if (direntFile != NULL) {
+	fclose(direntFile);
+      }
+      if (outputFile != NULL) {
+	fclose(outputFile);
+	unlink(outputPath.c_str());
+      }
+      if (!clusterPath.empty()) {
+	unlink(clusterPath.c_str());
+      }
+    }
+};
+
+/* Identifier of the file; it only has to differ from one ZIM file to
+   the next */
+static void generateUuid(const std::string &path, unsigned char uuid[16]) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  std::string seed = path;
+  appendUint64(seed, now.tv_sec);
+  appendUint64(seed, now.tv_usec);
+  appendUint64(seed, getpid());
+  appendUint64(seed, clock());
+
+  Md5Context md5;
+  md5Init(md5);
+  md5Update(md5, seed.data(), seed.size());
+  md5Final(md5, uuid);
+}
+
+/* Redirect whose target is a redirect too, in case that one is dropped */
+typedef struct {
+  uint32_t number;
+  uint32_t target;
+  uint32_t size;
+  std::string aid;
+} RedirectChain;
+
+inline bool isDropped(const std::vector<uint32_t> &dropped, uint32_t number) {
+  return std::binary_search(dropped.begin(), dropped.end(), number);
+}
+
+/* Index of a dirent once the dropped ones are gone */
+inline uint32_t getFinalNumber(const std::vector<uint32_t> &dropped, uint32_t number) {
+  return number - (std::lower_bound(dropped.begin(), dropped.end(), number) - dropped.begin());
+}
+
+static void checkMainPage(const std::string &aidRecord, const std::string &mainPageAid, uint32_t &mainPage) {
+  if (mainPage == ZIM_NO_PAGE && aidRecord.c_str() == mainPageAid) {
+    mainPage = readUint32BE(aidRecord.data() + mainPageAid.size() + 1);
+  }
+}
+
+NativeZimCreator::NativeZimCreator() {
+  minChunkSize = 1024;
+  maxMemory = 0;
+  long processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+  threadCount = processorCount > 0 ? processorCount : 1;
+}
+
+void NativeZimCreator::setMinChunkSize(int size) {
+  minChunkSize = size > 0 ? size : 1;
+}
+
+void NativeZimCreator::setThreadCount(unsigned int count) {
+  threadCount = count > 0 ? count : 1;
+}
+
+void NativeZimCreator::setMaxMemory(size_t size) {
+  maxMemory = size;
+}
+
+void NativeZimCreator::create(const std::string& fname, zim::writer::ArticleSource& source) {
+  double startTime = getTime();
+
+  /* Clusters go to a temporary file until the directory, which comes
+     before them, is known */
+  ClusterPipeline pipeline;
+  pthread_mutex_init(&pipeline.mutex, NULL);
+  pthread_cond_init(&pipeline.clusterClosed, NULL);
+  pthread_cond_init(&pipeline.clusterCompressed, NULL);
+  pthread_cond_init(&pipeline.clusterWritten, NULL);
+  pipeline.pendingCount = 0;
+  pipeline.maxPendingCount = 2 * threadCount + 1;
+  pipeline.clusterCount = 0;
+  pipeline.isClosing = false;
+  pipeline.path = fname + ".tmp";
+  pipeline.size = 0;
+  pipeline.dataSize = 0;
+  pipeline.file = fopen(pipeline.path.c_str(), "wb");
+  if (pipeline.file == NULL) {
+    throw std::runtime_error("Unable to open " + pipeline.path);
+  }
+
+  std::vector<pthread_t> compressors(threadCount);
+  for (unsigned int i = 0; i < threadCount; i++) {
+    pthread_create(&compressors[i], NULL, compressClusters, &pipeline);
+  }
+  pthread_t writer;
+  pthread_create(&writer, NULL, writeClusters, &pipeline);
+
+  /* Fill the clusters in article order, one for the articles to
+     compress and one for the others; the dirents are sorted as they
+     come, in a quarter of the memory budget like the other sorters of
+     the directory */
+  size_t sorterBudget = maxMemory > 0 ? maxMemory / 4 : (size_t)-1;
+  RecordSorter urlSorter(fname + ".urls", sorterBudget);
+  std::vector<uint32_t> clusterNumbers;
+  std::vector<std::string> mimeTypes;
+  std::map<std::string, uint16_t> mimeTypeIds;
+  Cluster *openClusters[2] = { NULL, NULL };
+  const zim::writer::Article *article;
+  uint32_t articleNumber = 0;
+  std::string record;
+
+  /* On errors, the threads are stopped before the pipeline goes out of
+     scope, and the temporary file removed */
+  try {
+    while ((article = source.getNextArticle()) != NULL) {
+      Dirent dirent;
+      dirent.ns = article->getNamespace();
+      dirent.url = article->getUrl();
+      dirent.title = article->getTitle();
+      if (dirent.title == dirent.url) {
+	dirent.title.clear();
+      }
+      dirent.aid = article->getAid();
+      dirent.cluster = 0;
+      dirent.blob = 0;
+
+      if (article->isRedirect()) {
+	dirent.mimeType = ZIM_REDIRECT_MIME_TYPE;
+	dirent.redirectAid = article->getRedirectAid();
+      } else {
+	std::string mimeType = article->getMimeType();
+	std::map<std::string, uint16_t>::iterator found = mimeTypeIds.find(mimeType);
+	if (found == mimeTypeIds.end()) {
+	  found = mimeTypeIds.insert(std::make_pair(mimeType, (uint16_t)mimeTypes.size())).first;
+	  mimeTypes.push_back(mimeType);
+	}
+	dirent.mimeType = found->second;
+
+	bool isCompressed = article->shouldCompress();
+	zim::Blob blob = source.getData(dirent.aid);
+	Cluster *&cluster = openClusters[isCompressed ? 1 : 0];
+	if (cluster == NULL) {
+	  cluster = new Cluster();
+	  cluster->isCompressed = isCompressed;
+	  cluster->openNumber = clusterNumbers.size();
+	  clusterNumbers.push_back(0);
+	}
+	dirent.cluster = cluster->openNumber;
+	dirent.blob = cluster->blobOffsets.size();
+	cluster->blobOffsets.push_back(cluster->data.size());
+	cluster->data.append(blob.data(), blob.size());
+	if (cluster->data.size() >= minChunkSize * 1024) {
+	  closeCluster(pipeline, cluster, clusterNumbers);
+	  cluster = NULL;
+	}
+      }
+      encodeDirent(dirent, articleNumber++, record);
+      urlSorter.add(record);
+    }
+
+    for (unsigned int i = 0; i < 2; i++) {
+      if (openClusters[i] != NULL) {
+	closeCluster(pipeline, openClusters[i], clusterNumbers);
+	openClusters[i] = NULL;
+      }
+    }
+  } catch (...) {
+    for (unsigned int i = 0; i < 2; i++) {
+      delete(openClusters[i]);
+    }
+    closePipeline(pipeline, compressors, writer);
+    fclose(pipeline.file);
+    unlink(pipeline.path.c_str());
+    throw;
+  }
+
+  closePipeline(pipeline, compressors, writer);
+  if (fclose(pipeline.file) != 0 && pipeline.error.empty()) {
+    pipeline.error = "Unable to write to " + pipeline.path;
+  }
+  if (!pipeline.error.empty()) {
+    unlink(pipeline.path.c_str());
+    throw std::runtime_error(pipeline.error);
+  }
+  double clusterTime = getTime();
+  PendingFiles pending;
+  pending.clusterPath = pipeline.path;
+
+  /* Dirents in URL order, without the duplicates, numbered in that
+     order: they are kept in a temporary file to be read again for the
+     URL pointers and for themselves, and their article ids, redirect
+     targets and titles go to sorters of their own.
+
+     Article ids: id, number and whether it's a redirect.
+     Redirect targets: target id, number, dirent size and id.
+     Titles: namespace, title (or URL) and number */
+  urlSorter.finish();
+  RecordSorter aidSorter(fname + ".aids", sorterBudget);
+  RecordSorter targetSorter(fname + ".targets", sorterBudget);
+  RecordSorter titleSorter(fname + ".titles", sorterBudget);
+  std::string direntPath = fname + ".dirents";
+  FILE *direntFile = openTemporaryFile(direntPath);
+  pending.direntFile = direntFile;
+  uint32_t direntCount = 0;
+  uint64_t direntSize = 0;
+  Dirent dirent;
+  char previousNs = 0;
+  std::string previousUrl;
+  std::string sortRecord;
+
+  while (urlSorter.next(record)) {
+    decodeDirent(record, dirent);
+    if (direntCount > 0 && dirent.ns == previousNs && dirent.url == previousUrl) {
+      std::cerr << "Duplicate article " << dirent.ns << "/" << dirent.url << ", skipping it" << std::endl;
+      continue;
+    }
+    previousNs = dirent.ns;
+    previousUrl = dirent.url;
+    writeRecord(direntFile, direntPath, record);
+    direntSize += getDirentSize(dirent);
+
+    sortRecord.assign(dirent.aid.c_str(), dirent.aid.size() + 1);
+    appendUint32BE(sortRecord, direntCount);
+    sortRecord += (char)isRedirect(dirent);
+    aidSorter.add(sortRecord);
+
+    if (isRedirect(dirent)) {
+      sortRecord.assign(dirent.redirectAid.c_str(), dirent.redirectAid.size() + 1);
+      appendUint32BE(sortRecord, direntCount);
+      appendUint32(sortRecord, getDirentSize(dirent));
+      sortRecord.append(dirent.aid.c_str(), dirent.aid.size() + 1);
+      targetSorter.add(sortRecord);
+    }
+
+    sortRecord.assign(1, dirent.ns);
+    if (dirent.title.empty()) {
+      sortRecord.append(dirent.url.c_str(), dirent.url.size() + 1);
+    } else {
+      sortRecord.append(dirent.title.c_str(), dirent.title.size() + 1);
+    }
+    appendUint32BE(sortRecord, direntCount);
+    titleSorter.add(sortRecord);
+    direntCount++;
+  }
+  unsigned int runCount = urlSorter.getRunCount();
+  urlSorter.close();
+
+  /* Redirects get the number of their target by walking the targets
+     and the article ids in id order together; the (redirect, target)
+     pairs are then sorted back in dirent order.  Those whose target
+     is missing are dropped, as are those which redirect to them */
+  aidSorter.finish();
+  targetSorter.finish();
+  RecordSorter redirectSorter(fname + ".redirects", sorterBudget);
+  std::map<uint32_t, uint32_t> droppedSizes;
+  std::vector<RedirectChain> chains;
+  uint32_t mainPage = ZIM_NO_PAGE;
+  std::string mainPageAid = source.getMainPage();
+  std::string aidRecord;
+  bool hasAid = aidSorter.next(aidRecord);
+
+  while (targetSorter.next(record)) {
+    const char *target = record.c_str();
+    const char *fields = target + strlen(target) + 1;
+    while (hasAid && strcmp(aidRecord.c_str(), target) < 0) {
+      checkMainPage(aidRecord, mainPageAid, mainPage);
+      hasAid = aidSorter.next(aidRecord);
+    }
+
+    uint32_t number = readUint32BE(fields);
+    if (hasAid && aidRecord.c_str() == std::string(target)) {
+      const char *aidFields = aidRecord.data() + strlen(target) + 1;
+      sortRecord.clear();
+      appendUint32BE(sortRecord, number);
+      appendUint32(sortRecord, readUint32BE(aidFields));
+      redirectSorter.add(sortRecord);
+      if (aidFields[4]) {
+	RedirectChain chain = { number, readUint32BE(aidFields), readUint32(fields + 4), fields + 8 };
+	chains.push_back(chain);
+      }
+    } else {
+      std::cerr << "Unable to find the target of redirect " << fields + 8 << ": " << target << std::endl;
+      droppedSizes[number] = readUint32(fields + 4);
+    }
+  }
+  while (hasAid) {
+    checkMainPage(aidRecord, mainPageAid, mainPage);
+    hasAid = aidSorter.next(aidRecord);
+  }
+  runCount += aidSorter.getRunCount() + targetSorter.getRunCount();
+  aidSorter.close();
+  targetSorter.close();
+
+  bool isDropping = !droppedSizes.empty();
+  while (isDropping) {
+    isDropping = false;
+    for (size_t i = 0; i < chains.size(); i++) {
+      if (droppedSizes.find(chains[i].number) == droppedSizes.end() &&
+	  droppedSizes.find(chains[i].target) != droppedSizes.end()) {
+	std::cerr << "Unable to find the final target of redirect " << chains[i].aid << std::endl;
+	droppedSizes[chains[i].number] = chains[i].size;
+	isDropping = true;
+      }
+    }
+  }
+  std::vector<RedirectChain>().swap(chains);
+
+  std::vector<uint32_t> dropped;
+  for (std::map<uint32_t, uint32_t>::iterator it = droppedSizes.begin(); it != droppedSizes.end(); ++it) {
+    dropped.push_back(it->first);
+    direntSize -= it->second;
+  }
+  std::map<uint32_t, uint32_t>().swap(droppedSizes);
+  if (mainPage != ZIM_NO_PAGE && isDropped(dropped, mainPage)) {
+    mainPage = ZIM_NO_PAGE;
+  }
+  if (!mainPageAid.empty() && mainPage == ZIM_NO_PAGE) {
+    std::cerr << "Unable to find the main page " << mainPageAid << std::endl;
+  } else if (mainPage != ZIM_NO_PAGE) {
+    mainPage = getFinalNumber(dropped, mainPage);
+  }
+  uint32_t entryCount = direntCount - dropped.size();
+
+  /* Layout: header, mime-types, URL pointers, title index, dirents,
+     cluster pointers, clusters and checksum */
+  uint64_t mimeListPos = ZIM_HEADER_SIZE;
+  uint64_t urlPtrPos = mimeListPos + 1;
+  for (size_t i = 0; i < mimeTypes.size(); i++) {
+    urlPtrPos += mimeTypes[i].size() + 1;
+  }
+  uint64_t titlePtrPos = urlPtrPos + 8 * (uint64_t)entryCount;
+  uint64_t direntPos = titlePtrPos + 4 * (uint64_t)entryCount;
+  uint64_t clusterPtrPos = direntPos + direntSize;
+  uint64_t clusterPos = clusterPtrPos + 8 * (uint64_t)pipeline.clusterCount;
+  uint64_t checksumPos = clusterPos + pipeline.size;
+
+  OutputFile output;
+  output.path = fname + ".part";
+  output.file = fopen(output.path.c_str(), "wb");
+  if (output.file == NULL) {
+    throw std::runtime_error("Unable to open " + output.path);
+  }
+  pending.outputFile = output.file;
+  pending.outputPath = output.path;
+  output.buffer.reserve(outputBufferSize + 4096);
+  md5Init(output.md5);
+
+  unsigned char uuid[16];
+  generateUuid(fname, uuid);
+  std::string buffer;
+  appendUint32(buffer, ZIM_MAGIC_NUMBER);
+  appendUint16(buffer, ZIM_MAJOR_VERSION);
+  appendUint16(buffer, ZIM_MINOR_VERSION);
+  buffer.append(reinterpret_cast<char*>(uuid), 16);
+  appendUint32(buffer, entryCount);
+  appendUint32(buffer, pipeline.clusterCount);
+  appendUint64(buffer, urlPtrPos);
+  appendUint64(buffer, titlePtrPos);
+  appendUint64(buffer, clusterPtrPos);
+  appendUint64(buffer, mimeListPos);
+  appendUint32(buffer, mainPage);
+  appendUint32(buffer, ZIM_NO_PAGE);
+  appendUint64(buffer, checksumPos);
+  for (size_t i = 0; i < mimeTypes.size(); i++) {
+    buffer.append(mimeTypes[i].c_str(), mimeTypes[i].size() + 1);
+  }
+  buffer += '\0';
+  writeOutput(output, buffer.data(), buffer.size());
+
+  uint64_t position = direntPos;
+  rewind(direntFile);
+  for (uint32_t number = 0; readRecord(direntFile, record); number++) {
+    if (!isDropped(dropped, number)) {
+      decodeDirent(record, dirent);
+      buffer.clear();
+      appendUint64(buffer, position);
+      writeOutput(output, buffer.data(), buffer.size());
+      position += getDirentSize(dirent);
+    }
+  }
+
+  titleSorter.finish();
+  while (titleSorter.next(record)) {
+    uint32_t number = readUint32BE(record.data() + record.size() - 4);
+    if (!isDropped(dropped, number)) {
+      buffer.clear();
+      appendUint32(buffer, getFinalNumber(dropped, number));
+      writeOutput(output, buffer.data(), buffer.size());
+    }
+  }
+  runCount += titleSorter.getRunCount();
+  titleSorter.close();
+
+  redirectSorter.finish();
+  std::string redirectRecord;
+  bool hasRedirect = redirectSorter.next(redirectRecord);
+  rewind(direntFile);
+  for (uint32_t number = 0; readRecord(direntFile, record); number++) {
+    if (isDropped(dropped, number)) {
+      continue;
+    }
+    decodeDirent(record, dirent);
+    buffer.clear();
+    appendUint16(buffer, dirent.mimeType);
+    buffer += '\0';
+    buffer += dirent.ns;
+    appendUint32(buffer, 0);
+    if (isRedirect(dirent)) {
+      while (hasRedirect && readUint32BE(redirectRecord.data()) < number) {
+	hasRedirect = redirectSorter.next(redirectRecord);
+      }
+      appendUint32(buffer, getFinalNumber(dropped, readUint32(redirectRecord.data() + 4)));
+    } else {
+      appendUint32(buffer, clusterNumbers[dirent.cluster]);
+      appendUint32(buffer, dirent.blob);
+    }
+    buffer.append(dirent.url.c_str(), dirent.url.size() + 1);
+    buffer.append(dirent.title.c_str(), dirent.title.size() + 1);
+    writeOutput(output, buffer.data(), buffer.size());
+  }
+  bool isRead = !ferror(direntFile);
+  pending.direntFile = NULL;
+  fclose(direntFile);
+  runCount += redirectSorter.getRunCount();
+  redirectSorter.close();
+  if (!isRead) {
+    throw std::runtime_error("Unable to read " + direntPath);
+  }
+
+  for (size_t i = 0; i < pipeline.clusterOffsets.size(); i++) {
+    buffer.clear();
+    appendUint64(buffer, clusterPos + pipeline.clusterOffsets[i]);
+    writeOutput(output, buffer.data(), buffer.size());
+  }
+
+  /* Copy the clusters over */
+  FILE *clusterFile = fopen(pipeline.path.c_str(), "rb");
+  if (clusterFile == NULL) {
+    throw std::runtime_error("Unable to open " + pipeline.path);
+  }
+  std::vector<char> chunk(outputBufferSize);
+  size_t count;
+  while ((count = fread(&chunk[0], 1, chunk.size(), clusterFile)) > 0) {
+    writeOutput(output, &chunk[0], count);
+  }
+  isRead = !ferror(clusterFile);
+  fclose(clusterFile);
+  if (!isRead) {
+    throw std::runtime_error("Unable to read " + pipeline.path);
+  }
+  unlink(pipeline.path.c_str());
+  pending.clusterPath.clear();
+  flushOutput(output);
+
+  unsigned char checksum[16];
+  md5Final(output.md5, checksum);
+  bool isWritten = fwrite(checksum, 1, 16, output.file) == 16;
+  pending.outputFile = NULL;
+  if (fclose(output.file) != 0 || !isWritten) {
+    unlink(output.path.c_str());
+    throw std::runtime_error("Unable to write to " + output.path);
+  }
+  if (rename(output.path.c_str(), fname.c_str()) != 0) {
+    unlink(output.path.c_str());
+    throw std::runtime_error("Unable to rename " + output.path + " to " + fname);
+  }
+
+  double endTime = getTime();
+  std::cout << "Native writer: " << entryCount << " articles in " << pipeline.clusterCount << " clusters, "
+	    << std::fixed << std::setprecision(1) << pipeline.dataSize / 1048576.0 << " MiB written as "
+	    << (checksumPos + 16) / 1048576.0 << " MiB by " << threadCount << " threads in "
+	    << endTime - startTime << " s (" << endTime - clusterTime << " s for the directory";
+  if (runCount > 0) {
+    std::cout << ", sorted in " << runCount << " runs";
+  }
+  std::cout << ")" << std::endl;
+}
@@ -0,0 +1,33 @@
+#ifndef NATIVECREATOR_H
+#define NATIVECREATOR_H
+
+#include <string>
+
+#include <zim/writer/zimcreator.h>
+
+/* ZIM creator of --writer=native: it takes the same article source as
+   zim::writer::ZimCreator and writes the same format, but compresses
+   the clusters on several threads.  Clusters are filled in the order
+   the articles come in and written in that order too, whatever the
+   number of threads, so the output doesn't depend on it */
+class NativeZimCreator {
+  public:
+    NativeZimCreator();
+
+    /* Size above which a cluster is closed, in KiB */
+    void setMinChunkSize(int size);
+    void setThreadCount(unsigned int count);
+
+    /* Memory the directory may take before being sorted on disk, in
+       bytes; 0 for no limit */
+    void setMaxMemory(size_t size);
+
+    void create(const std::string& fname, zim::writer::ArticleSource& source);
+
+  private:
+    unsigned int minChunkSize;
+    unsigned int threadCount;
+    size_t maxMemory;
+};
+
+#endif
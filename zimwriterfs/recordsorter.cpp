@@ -0,0 +1,220 @@
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#include "recordsorter.h"
+
+/* Runs merged at once into one of the next level */
+#define RECORD_SORTER_FAN_IN 64
+
+static void appendUint32(std::string &buffer, uint32_t value) {
+  for (unsigned int i = 0; i < 4; i++) {
+    buffer += (char)((value >> (8 * i)) & 0xff);
+  }
+}
+
+static uint32_t readUint32(const char *data) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/* Orders the records of the buffer of a RecordSorter, each a 32 bit
+   length followed by its bytes */
+struct BufferedRecordLess {
+  const char *buffer;
+  explicit BufferedRecordLess(const char *buffer_) : buffer(buffer_) {}
+  bool operator()(size_t a, size_t b) const {
+    uint32_t first = readUint32(buffer + a);
+    uint32_t second = readUint32(buffer + b);
+    int order = memcmp(buffer + a + 4, buffer + b + 4, std::min(first, second));
+    return order < 0 || (order == 0 && first < second);
+  }
+};
+
+bool readRecord(FILE *file, std::string &record) {
+  char length[4];
+  if (fread(length, 1, 4, file) != 4) {
+    return false;
+  }
+  record.resize(readUint32(length));
+  return record.empty() || fread(&record[0], 1, record.size(), file) == record.size();
+}
+
+FILE *openTemporaryFile(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "w+b");
+  if (file == NULL) {
+    throw std::runtime_error("Unable to open " + path);
+  }
+  unlink(path.c_str());
+  return file;
+}
+
+void writeRecord(FILE *file, const std::string &path, const std::string &record) {
+  char length[4] = { (char)(record.size() & 0xff), (char)((record.size() >> 8) & 0xff),
+		     (char)((record.size() >> 16) & 0xff), (char)((record.size() >> 24) & 0xff) };
+  if (fwrite(length, 1, 4, file) != 4 || fwrite(record.data(), 1, record.size(), file) != record.size()) {
+    throw std::runtime_error("Unable to write to " + path);
+  }
+}
+
+RecordSorter::RecordSorter(const std::string &path_, size_t memoryBudget_) {
+  path = path_;
+  memoryBudget = memoryBudget_;
+  memorySize = 0;
+  position = 0;
+  runCount = 0;
+}
+
+RecordSorter::~RecordSorter() {
+  close();
+}
+
+/* Free the records, once they have been read */
+void RecordSorter::close() {
+  for (size_t i = 0; i < runs.size(); i++) {
+    fclose(runs[i]);
+  }
+  runs.clear();
+  runLevels.clear();
+  std::string().swap(buffer);
+  std::vector<size_t>().swap(offsets);
+  while (!heads.empty()) {
+    heads.pop();
+  }
+}
+
+void RecordSorter::add(const std::string &record) {
+  /* Offsets count twice, for the room the vector grows into */
+  size_t size = 4 + record.size() + 2 * sizeof(size_t);
+  if (memorySize + size > memoryBudget && !offsets.empty()) {
+    spill();
+  }
+  if (buffer.capacity() == 0 && memoryBudget != (size_t)-1) {
+    buffer.reserve(memoryBudget);
+  }
+  offsets.push_back(buffer.size());
+  appendUint32(buffer, record.size());
+  buffer += record;
+  memorySize += size;
+}
+
+void RecordSorter::spill() {
+  std::sort(offsets.begin(), offsets.end(), BufferedRecordLess(buffer.data()));
+
+  std::ostringstream runPath;
+  runPath << path << "." << runCount;
+  FILE *run = openTemporaryFile(runPath.str());
+  runs.push_back(run);
+  runLevels.push_back(0);
+  runCount++;
+
+  for (size_t i = 0; i < offsets.size(); i++) {
+    size_t size = 4 + readUint32(buffer.data() + offsets[i]);
+    if (fwrite(buffer.data() + offsets[i], 1, size, run) != size) {
+      throw std::runtime_error("Unable to write to " + runPath.str());
+    }
+  }
+  if (fflush(run) != 0) {
+    throw std::runtime_error("Unable to write to " + runPath.str());
+  }
+  buffer.clear();
+  offsets.clear();
+  memorySize = 0;
+
+  /* The runs are in decreasing level order, the last ones being the
+     ones to merge */
+  while (runs.size() >= RECORD_SORTER_FAN_IN &&
+	 runLevels[runs.size() - RECORD_SORTER_FAN_IN] == runLevels.back()) {
+    mergeRuns();
+  }
+}
+
+/* Merge the last RECORD_SORTER_FAN_IN runs, all of the same level,
+   into one of the next level */
+void RecordSorter::mergeRuns() {
+  size_t first = runs.size() - RECORD_SORTER_FAN_IN;
+  std::ostringstream runPath;
+  runPath << path << ".merged." << runCount << "." << runLevels.back() + 1;
+  FILE *run = openTemporaryFile(runPath.str());
+
+  std::priority_queue<std::pair<std::string, size_t>, std::vector<std::pair<std::string, size_t> >,
+		      std::greater<std::pair<std::string, size_t> > > mergedHeads;
+  std::string record;
+  for (size_t i = first; i < runs.size(); i++) {
+    rewind(runs[i]);
+    if (readRecord(runs[i], record)) {
+      mergedHeads.push(std::make_pair(record, i));
+    }
+  }
+  while (!mergedHeads.empty()) {
+    size_t i = mergedHeads.top().second;
+    writeRecord(run, runPath.str(), mergedHeads.top().first);
+    mergedHeads.pop();
+    if (readRecord(runs[i], record)) {
+      mergedHeads.push(std::make_pair(record, i));
+    } else if (ferror(runs[i])) {
+      throw std::runtime_error("Unable to read " + path);
+    }
+  }
+  if (fflush(run) != 0) {
+    throw std::runtime_error("Unable to write to " + runPath.str());
+  }
+
+  unsigned int level = runLevels.back() + 1;
+  for (size_t i = first; i < runs.size(); i++) {
+    fclose(runs[i]);
+  }
+  runs.resize(first);
+  runLevels.resize(first);
+  runs.push_back(run);
+  runLevels.push_back(level);
+}
+
+void RecordSorter::finish() {
+  if (runs.empty()) {
+    std::sort(offsets.begin(), offsets.end(), BufferedRecordLess(buffer.data()));
+    return;
+  }
+  if (!offsets.empty()) {
+    spill();
+  }
+  std::string().swap(buffer);
+  std::vector<size_t>().swap(offsets);
+
+  std::string record;
+  for (size_t i = 0; i < runs.size(); i++) {
+    rewind(runs[i]);
+    if (readRecord(runs[i], record)) {
+      heads.push(std::make_pair(record, i));
+    }
+  }
+}
+
+bool RecordSorter::next(std::string &record) {
+  if (runs.empty()) {
+    if (position == offsets.size()) {
+      return false;
+    }
+    size_t offset = offsets[position++];
+    record.assign(buffer.data() + offset + 4, readUint32(buffer.data() + offset));
+    return true;
+  }
+
+  if (heads.empty()) {
+    return false;
+  }
+  size_t run = heads.top().second;
+  record = heads.top().first;
+  heads.pop();
+  std::string head;
+  if (readRecord(runs[run], head)) {
+    heads.push(std::make_pair(head, run));
+  } else if (ferror(runs[run])) {
+    throw std::runtime_error("Unable to read " + path);
+  }
+  return true;
+}
@@ -0,0 +1,50 @@
+#ifndef RECORDSORTER_H
+#define RECORDSORTER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <queue>
+#include <functional>
+
+/* Sorted records, keeping at most memoryBudget bytes of them in memory:
+   beyond that, they are sorted and spilled as a run to a temporary
+   file, and the runs are merged as the records are read back.  Records
+   are compared bytewise.  Runs are merged into larger ones as they
+   pile up, so that only a few of them are ever open */
+class RecordSorter {
+  public:
+    RecordSorter(const std::string &path, size_t memoryBudget);
+    ~RecordSorter();
+    void add(const std::string &record);
+    void finish();
+    bool next(std::string &record);
+    void close();
+    unsigned int getRunCount() const { return runCount; }
+
+  private:
+    std::string path;
+    size_t memoryBudget;
+    size_t memorySize;
+    std::string buffer;
+    std::vector<size_t> offsets;
+    size_t position;
+    std::vector<FILE*> runs;
+    std::vector<unsigned int> runLevels;
+    unsigned int runCount;
+    std::priority_queue<std::pair<std::string, size_t>, std::vector<std::pair<std::string, size_t> >,
+			std::greater<std::pair<std::string, size_t> > > heads;
+
+    void spill();
+    void mergeRuns();
+};
+
+/* Unlinked right away, the file goes when it's closed */
+FILE *openTemporaryFile(const std::string &path);
+
+/* Records of a temporary file, each a 32 bit length followed by its
+   bytes */
+bool readRecord(FILE *file, std::string &record);
+void writeRecord(FILE *file, const std::string &path, const std::string &record);
+
+#endif
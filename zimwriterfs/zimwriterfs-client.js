@@ -0,0 +1,131 @@
+#!/usr/bin/env node
+"use strict";
+
+/* Reference client of "zimwriterfs --listen=unix:PATH", to stream the
+   files of a ZIM file to zimwriterfs instead of writing them to disk.
+
+   Each file is sent as a record of five fields, each a 32 bit
+   big-endian length followed by that many bytes: path, mime-type,
+   title, redirect target and content. The mime-type and the title may
+   be empty, zimwriterfs then finds them out as for the files of a
+   directory. All fields but the content are at most 4096 bytes long.
+   Redirects have an empty content. A record with an empty
+   path ends the stream and lets zimwriterfs finish the ZIM file.
+
+   As a module:
+
+     var zimwriterfs = require( './zimwriterfs-client.js' );
+     var client = zimwriterfs.connect( '/tmp/zim.sock', function() {
+         client.writeFile( 'html/Foo.html', 'text/html', 'Foo', html, function() {
+             client.writeRedirect( 'html/Bar.html', 'Bar', 'html/Foo.html' );
+             client.end();
+         });
+     });
+
+   The callbacks are only called once zimwriterfs has room for more, so
+   that a producer waiting for them doesn't run ahead of it.
+
+   As a command, it sends the files of a directory:
+
+     zimwriterfs-client.js /tmp/zim.sock DIRECTORY
+*/
+
+var net = require( 'net' );
+var fs = require( 'fs' );
+var pathParser = require( 'path' );
+
+function encodeField( value ) {
+    var data = Buffer.isBuffer( value ) ? value : Buffer.from( value || '', 'utf8' );
+    var length = Buffer.alloc( 4 );
+    length.writeUInt32BE( data.length, 0 );
+    return [ length, data ];
+}
+
+function Client( socketPath, callback ) {
+    this.socket = net.connect( socketPath, callback );
+    this.socket.on( 'error', function( error ) {
+	console.error( 'Unable to write to zimwriterfs at ' + socketPath + ' - ' + error );
+	process.exit( 1 );
+    });
+}
+
+Client.prototype.writeRecord = function( path, mimeType, title, redirect, data, callback ) {
+    var socket = this.socket;
+    var fields = [].concat( encodeField( path ), encodeField( mimeType ), encodeField( title ),
+			    encodeField( redirect ), encodeField( data ) );
+    var hasRoom = true;
+
+    socket.cork();
+    fields.forEach( function( field ) {
+	hasRoom = socket.write( field );
+    });
+    socket.uncork();
+
+    if ( callback ) {
+	if ( hasRoom ) {
+	    setImmediate( callback );
+	} else {
+	    socket.once( 'drain', callback );
+	}
+    }
+};
+
+Client.prototype.writeFile = function( path, mimeType, title, data, callback ) {
+    if ( !path ) {
+	console.error( 'Files sent to zimwriterfs need a path' );
+	process.exit( 1 );
+    }
+    this.writeRecord( path, mimeType, title, '', data, callback );
+};
+
+Client.prototype.writeRedirect = function( path, title, target, callback ) {
+    if ( !path || !target ) {
+	console.error( 'Redirects sent to zimwriterfs need a path and a target' );
+	process.exit( 1 );
+    }
+    this.writeRecord( path, '', title, target, '', callback );
+};
+
+Client.prototype.end = function( callback ) {
+    this.socket.end( Buffer.concat( encodeField( '' ) ), callback );
+};
+
+function connect( socketPath, callback ) {
+    return new Client( socketPath, callback );
+}
+
+/* Paths of the files of a directory, relative to it */
+function listFiles( directory, prefix, paths ) {
+    fs.readdirSync( pathParser.join( directory, prefix ) ).forEach( function( name ) {
+	var path = prefix ? prefix + '/' + name : name;
+	var stats = fs.statSync( pathParser.join( directory, path ) );
+	if ( stats.isDirectory() ) {
+	    listFiles( directory, path, paths );
+	} else if ( stats.isFile() ) {
+	    paths.push( path );
+	}
+    });
+    return paths;
+}
+
+if ( require.main === module ) {
+    if ( process.argv.length != 4 ) {
+	console.error( 'Usage: zimwriterfs-client.js SOCKET DIRECTORY' );
+	process.exit( 1 );
+    }
+
+    var directory = process.argv[3];
+    var paths = listFiles( directory, '', [] );
+    var client = connect( process.argv[2], function sendNext() {
+	var path = paths.shift();
+	if ( path === undefined ) {
+	    client.end();
+	} else {
+	    client.writeFile( path, '', '', fs.readFileSync( pathParser.join( directory, path ) ), sendNext );
+	}
+    });
+}
+
+module.exports = {
+    connect: connect
+};
@@ -14,9 +14,18 @@
 #include <sstream>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <map>
+#include <set>
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <cerrno>
+#include <cmath>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdint.h>
 
 #include <magic.h>
 
@@ -25,7 +34,19 @@
 
 #include <gumbo.h>
 
+#include "nativecreator.h"
+#include "recordsorter.h"
+
 #define MAX_QUEUE_SIZE 100
+#define MAX_STUB_SIZE 2048
+#define COMPRESSION_SAMPLE_SIZE 4096
+#define MIN_COMPRESSION_SAMPLE_SIZE 256
+#define MAX_COMPRESSION_RATIO 0.9375
+#define ORDER_SAMPLE_SIZE 65536
+#define ORDER_MIN_WORD_SIZE 4
+#define ORDER_MEMORY_BUDGET (64 * 1024 * 1024)
+#define MAX_LISTENED_FIELD_SIZE 4096
+#define LISTENED_CHUNK_SIZE (1024 * 1024)
 
 #ifdef _WIN32
 #define SEPARATOR "\\"
@@ -43,6 +64,15 @@ std::string welcome;
 std::string favicon; 
 std::string directoryPath;
 std::string zimPath;
+std::string redirectsPath;
+std::string cachePath;
+std::string listenPath;
+std::string filesFromPath;
+std::string writerName = "zimlib";
+unsigned int threadCount = 0;
+unsigned int maxMemory = 0;
+std::string orderName;
+std::string popularityPath;
 zim::writer::ZimCreator zimCreator;
 pthread_t directoryVisitor;
 pthread_mutex_t filenameQueueMutex;
@@ -57,7 +87,463 @@ std::map<std::string, std::string> extMimeTypes;
 char *data = NULL;
 unsigned int dataSize = 0;
 
+/* Parser reused for the <head> of every HTML article; articles are
+   only created by the thread pulling them for the ZIM creator */
+GumboPushParser *htmlParser = NULL;
+
+/* Redirect stub pages recognized by scanRedirectStub, and those which
+   had to be parsed, with the time spent on each kind */
+unsigned int scannedStubCount = 0;
+unsigned int parsedStubCount = 0;
+double scannedStubSeconds = 0;
+double parsedStubSeconds = 0;
+
+/* --compress and --no-compress: mime-types whose files are always, or
+   never, compressed; a type followed by a slash and an asterisk stands
+   for all of its subtypes */
+std::map<std::string, bool> compressionOverrides;
+
+/* Compression decisions, with the files compressed which wouldn't be
+   if only text/ ones were, and what they are estimated to save */
+unsigned int compressedFileCount = 0;
+unsigned long long compressedFileSize = 0;
+unsigned int storedFileCount = 0;
+unsigned long long storedFileSize = 0;
+unsigned int precompressedFileCount = 0;
+unsigned int nonTextCompressedFileCount = 0;
+unsigned long long nonTextCompressedFileSize = 0;
+double nonTextSavedSize = 0;
+
+inline double getTime() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+/* DIRECTORY may also be a tar archive, compressed with gzip or zstd or
+   not, or be replaced by WARC files.  A first pass over it indexes the
+   regular files (extension-less ones get their mime-type from libmagic
+   then, and fonts are kept in memory for the CSS to inline them); after
+   that, the files are read from the stream in archive order, which is
+   the order they are added in, so that each is only read once unless
+   it is asked for again */
+typedef struct {
+  unsigned long long offset;
+  unsigned long long size;
+  long long mtime;
+
+  /* WARC records only: the file they are in, the length of their
+     payload as stored (chunked or not) and their target if they are
+     redirects */
+  size_t input;
+  unsigned long long length;
+  bool isChunked;
+  std::string redirectAid;
+} ArchiveEntry;
+
+/* A file read sequentially, through a decompressor if needed */
+typedef struct {
+  std::string path;
+  std::string decompressor;
+  FILE *file;
+  unsigned long long position;
+} InputStream;
+
+static const size_t archiveMagicBytes = 1024 * 1024;
+bool isArchive = false;
+bool isWarc = false;
+bool isListening = false;
+std::vector<std::string> warcPaths;
+InputStream archive = { "", "", NULL, 0 };
+std::map<std::string, ArchiveEntry> archiveIndex;
+std::vector<std::string> archivePaths;
+std::map<std::string, std::string> archiveFonts;
+std::string archiveEntryAid;
+std::string archiveEntryTitle;
+std::string archiveEntryData;
+
+static std::string shellQuote(const std::string &argument) {
+  std::string quoted = "'";
+  for (size_t i = 0; i < argument.size(); i++) {
+    if (argument[i] == '\'') {
+      quoted += "'\\''";
+    } else {
+      quoted += argument[i];
+    }
+  }
+  return quoted + "'";
+}
+
+/* The command decompressing the file to its standard output, from its
+   first bytes; empty if it isn't compressed */
+static std::string getDecompressor(const std::string &path) {
+  unsigned char signature[4] = { 0, 0, 0, 0 };
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    std::cerr << "Unable to open " << path << std::endl;
+    exit(1);
+  }
+  fread(signature, 1, sizeof(signature), file);
+  fclose(file);
+  if (signature[0] == 0x1f && signature[1] == 0x8b) {
+    return "gzip -dc";
+  } else if (signature[0] == 0x28 && signature[1] == 0xb5 &&
+	     signature[2] == 0x2f && signature[3] == 0xfd) {
+    return "zstd -dc";
+  }
+  return "";
+}
+
+static void openInputStream(InputStream &stream) {
+  if (stream.decompressor.empty()) {
+    stream.file = fopen(stream.path.c_str(), "rb");
+  } else {
+    stream.file = popen((stream.decompressor + " " + shellQuote(stream.path)).c_str(), "r");
+  }
+  if (stream.file == NULL) {
+    std::cerr << "Unable to open " << stream.path << std::endl;
+    exit(1);
+  }
+  stream.position = 0;
+}
+
+static void closeInputStream(InputStream &stream) {
+  if (stream.file != NULL) {
+    if (stream.decompressor.empty()) {
+      fclose(stream.file);
+    } else {
+      pclose(stream.file);
+    }
+    stream.file = NULL;
+  }
+}
+
+/* Read from the (decompressed) stream, false at its end */
+static bool readInputBytes(InputStream &stream, char *buffer, size_t length) {
+  size_t read = fread(buffer, 1, length, stream.file);
+  stream.position += read;
+  return read == length;
+}
+
+static void readInputString(InputStream &stream, std::string &content, size_t length) {
+  size_t start = content.size();
+  content.resize(start + length);
+  if (length > 0 && !readInputBytes(stream, &content[start], length)) {
+    std::cerr << "Unexpected end of " << stream.path << std::endl;
+    exit(1);
+  }
+}
+
+/* Read a line, without its CR LF, and no further than limit; false at
+   the end of the stream */
+static bool readInputLine(InputStream &stream, std::string &line, unsigned long long limit) {
+  int c = EOF;
+  line.clear();
+  while (stream.position < limit && (c = getc(stream.file)) != EOF) {
+    stream.position++;
+    if (c == '\n') {
+      break;
+    }
+    line += (char)c;
+  }
+  if (!line.empty() && line[line.size()-1] == '\r') {
+    line.erase(line.size()-1);
+  }
+  return c != EOF || !line.empty();
+}
+
+/* Move forward in the stream, or start over if the offset is behind;
+   only an uncompressed file can seek */
+static void seekInputStream(InputStream &stream, unsigned long long offset) {
+  if (stream.decompressor.empty()) {
+    if (offset != stream.position) {
+      if (fseeko(stream.file, offset, SEEK_SET) != 0) {
+	std::cerr << "Unable to seek in " << stream.path << std::endl;
+	exit(1);
+      }
+      stream.position = offset;
+    }
+    return;
+  }
+  if (offset < stream.position) {
+    closeInputStream(stream);
+    openInputStream(stream);
+  }
+  char chunk[65536];
+  while (stream.position < offset) {
+    size_t length = std::min((unsigned long long)sizeof(chunk), offset - stream.position);
+    if (!readInputBytes(stream, chunk, length)) {
+      std::cerr << "Unexpected end of " << stream.path << std::endl;
+      exit(1);
+    }
+  }
+}
+
+/* Octal, or base-256 if the high bit of the first byte is set */
+static unsigned long long parseTarNumber(const char *field, size_t length) {
+  unsigned long long value = 0;
+  if ((unsigned char)field[0] & 0x80) {
+    value = (unsigned char)field[0] & 0x7f;
+    for (size_t i = 1; i < length; i++) {
+      value = (value << 8) | (unsigned char)field[i];
+    }
+    return value;
+  }
+  size_t i = 0;
+  while (i < length && (field[i] == ' ' || field[i] == '\0')) {
+    i++;
+  }
+  while (i < length && field[i] >= '0' && field[i] <= '7') {
+    value = value * 8 + (field[i++] - '0');
+  }
+  return value;
+}
+
+static bool isTarChecksumValid(const char *header) {
+  unsigned long long sum = 0;
+  for (size_t i = 0; i < 512; i++) {
+    sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)header[i];
+  }
+  return sum == parseTarNumber(header + 148, 8);
+}
+
+/* Fields of the pax extended header records "LENGTH KEY=VALUE\n" */
+static void parsePaxHeader(const std::string &records, std::string &path, unsigned long long &size, bool &hasSize) {
+  size_t start = 0;
+  while (start < records.size()) {
+    size_t space = records.find(' ', start);
+    size_t length = strtoul(records.c_str() + start, NULL, 10);
+    if (space == std::string::npos || length == 0 || start + length > records.size()) {
+      return;
+    }
+    std::string record = records.substr(space + 1, start + length - space - 2);
+    size_t equal = record.find('=');
+    if (equal != std::string::npos) {
+      std::string key = record.substr(0, equal);
+      if (key == "path") {
+	path = record.substr(equal + 1);
+      } else if (key == "size") {
+	size = strtoull(record.c_str() + equal + 1, NULL, 10);
+	hasSize = true;
+      }
+    }
+    start += length;
+  }
+}
+
+inline bool isFontMimeType(const std::string &mimeType) {
+  return mimeType == "application/font-ttf" ||
+    mimeType == "application/font-woff" ||
+    mimeType == "application/vnd.ms-opentype";
+}
+
+/* First pass: index the regular files of the tar archive */
+static void indexArchive() {
+  archive.path = directoryPath;
+  archive.decompressor = getDecompressor(directoryPath);
+
+  std::cout << "Indexing archive " << directoryPath << std::endl;
+  openInputStream(archive);
+  char header[512];
+  std::string longPath;
+  unsigned long long paxSize = 0;
+  bool hasPaxSize = false;
+  while (readInputBytes(archive, header, sizeof(header)) && header[0] != '\0') {
+    if (!isTarChecksumValid(header)) {
+      std::cerr << directoryPath << " is not a tar archive, or is corrupted" << std::endl;
+      exit(1);
+    }
+    char type = header[156];
+    unsigned long long size = hasPaxSize ? paxSize : parseTarNumber(header + 124, 12);
+    unsigned long long padding = (512 - size % 512) % 512;
+    hasPaxSize = false;
+
+    /* Long paths of GNU tar and pax apply to the next entry */
+    if (type == 'L' || type == 'x') {
+      std::string content;
+      readInputString(archive, content, size);
+      seekInputStream(archive, archive.position + padding);
+      if (type == 'L') {
+	longPath = content.substr(0, strnlen(content.c_str(), content.size()));
+      } else {
+	parsePaxHeader(content, longPath, paxSize, hasPaxSize);
+      }
+      continue;
+    }
+
+    std::string path = longPath;
+    longPath.clear();
+    if (path.empty()) {
+      path.assign(header, strnlen(header, 100));
+      if (!memcmp(header + 257, "ustar", 5) && header[345] != '\0') {
+	path = std::string(header + 345, strnlen(header + 345, 155)) + "/" + path;
+      }
+    }
+    while (path.substr(0, 2) == "./") {
+      path = path.substr(2);
+    }
+
+    std::string content;
+    if ((type == '0' || type == '\0') && !path.empty()) {
+      ArchiveEntry entry;
+      entry.offset = archive.position;
+      entry.size = size;
+      entry.mtime = parseTarNumber(header + 136, 12);
+      archiveIndex[path] = entry;
+      archivePaths.push_back(path);
+
+      /* The mime-type is taken from the extension, or from the content
+	 as getMimeTypeForFile would */
+      std::string mimeType;
+      std::size_t dot = path.find_last_of(".");
+      if (dot != std::string::npos && extMimeTypes.find(path.substr(dot+1)) != extMimeTypes.end()) {
+	mimeType = extMimeTypes[path.substr(dot+1)];
+      } else {
+	readInputString(archive, content, std::min((unsigned long long)archiveMagicBytes, size));
+	const char *magicMimeType = magic_buffer(magic, content.data(), content.size());
+	if (magicMimeType != NULL) {
+	  mimeType = magicMimeType;
+	  if (mimeType.find(";") != std::string::npos) {
+	    mimeType = mimeType.substr(0, mimeType.find(";"));
+	  }
+	  fileMimeTypes[path] = mimeType;
+	}
+      }
+
+      if (isFontMimeType(mimeType)) {
+	readInputString(archive, content, size - content.size());
+	archiveFonts[path] = content;
+      }
+    }
+    seekInputStream(archive, archive.position + size - content.size() + padding);
+  }
+  closeInputStream(archive);
+  openInputStream(archive);
+  std::cout << "Found " << archivePaths.size() << " files in archive " << directoryPath << std::endl;
+}
+
+/* The path of a file of the archive, relative to it */
+inline bool getArchiveAid(const std::string &path, std::string &aid) {
+  if (!isArchive || path.compare(0, directoryPath.size() + 1, directoryPath + "/") != 0) {
+    return false;
+  }
+  aid = path.substr(directoryPath.size() + 1);
+  return true;
+}
+
+/* Decode an HTTP body sent with "Transfer-Encoding: chunked" */
+static bool decodeChunked(const std::string &body, std::string &decoded) {
+  size_t position = 0;
+  decoded.clear();
+  while (position < body.size()) {
+    size_t lineEnd = body.find('\n', position);
+    if (lineEnd == std::string::npos) {
+      return false;
+    }
+    unsigned long length = strtoul(body.c_str() + position, NULL, 16);
+    if (length == 0) {
+      return true;
+    }
+    position = lineEnd + 1;
+    if (position + length > body.size()) {
+      return false;
+    }
+    decoded.append(body, position, length);
+    position += length;
+    if (body.compare(position, 2, "\r\n") == 0) {
+      position += 2;
+    } else if (body.compare(position, 1, "\n") == 0) {
+      position++;
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+/* Read a file of the archive; the last one read is kept, as it is
+   usually asked for again to get its data */
+static bool readArchiveEntry(const std::string &aid, std::string &content) {
+  if (aid == archiveEntryAid) {
+    content = archiveEntryData;
+    return true;
+  }
+  std::map<std::string, std::string>::const_iterator font = archiveFonts.find(aid);
+  if (font != archiveFonts.end()) {
+    content = font->second;
+    return true;
+  }
+  std::map<std::string, ArchiveEntry>::const_iterator entry = archiveIndex.find(aid);
+  if (entry == archiveIndex.end() || !entry->second.redirectAid.empty() || isListening) {
+    return false;
+  }
+
+  /* WARC records are normally handed over by their reader, this is for
+     the ones asked for out of turn */
+  if (isWarc && archive.path != warcPaths[entry->second.input]) {
+    closeInputStream(archive);
+    archive.path = warcPaths[entry->second.input];
+    archive.decompressor = getDecompressor(archive.path);
+    openInputStream(archive);
+  }
+
+  seekInputStream(archive, entry->second.offset);
+  archiveEntryData.clear();
+  archiveEntryAid.clear();
+  if (isWarc) {
+    readInputString(archive, archiveEntryData, entry->second.length);
+    if (entry->second.isChunked) {
+      std::string body;
+      body.swap(archiveEntryData);
+      decodeChunked(body, archiveEntryData);
+    }
+  } else {
+    readInputString(archive, archiveEntryData, entry->second.size);
+  }
+  archiveEntryAid = aid;
+  content = archiveEntryData;
+  return true;
+}
+
+/* stat() for the files of DIRECTORY, be it an archive or not */
+inline int statFile(const std::string &path, struct stat *filestatus) {
+  std::string aid;
+  if (getArchiveAid(path, aid)) {
+    std::map<std::string, ArchiveEntry>::const_iterator entry = archiveIndex.find(aid);
+    if (entry == archiveIndex.end()) {
+      errno = ENOENT;
+      return -1;
+    }
+    memset(filestatus, 0, sizeof(*filestatus));
+    filestatus->st_mode = S_IFREG;
+    filestatus->st_size = entry->second.size;
+    filestatus->st_mtime = entry->second.mtime;
+    return 0;
+  }
+  return stat(path.c_str(), filestatus);
+}
+
+/* --files-from: the files of DIRECTORY to add, in order, and sorted to
+   be looked up; the others are never looked at */
+std::vector<std::string> listedFiles;
+std::vector<std::string> sortedListedFiles;
+std::set<std::string> unlistedFiles;
+
+inline bool isListedFile(const std::string &aid) {
+  return std::binary_search(sortedListedFiles.begin(), sortedListedFiles.end(), aid);
+}
+
 inline std::string getFileContent(const std::string &path) {
+  std::string aid;
+  if (getArchiveAid(path, aid)) {
+    std::string contents;
+    if (readArchiveEntry(aid, contents)) {
+      return contents;
+    }
+    std::cerr << "Unable to find file in archive: " << path << std::endl;
+    throw(ENOENT);
+  }
+
   std::ifstream in(path.c_str(), ::std::ios::binary);
   if (in) {
     std::string contents;
@@ -72,13 +558,66 @@ inline std::string getFileContent(const std::string &path) {
   throw(errno);
 }
 
+/* First bytes of a file, up to size */
+inline std::string getFileSample(const std::string &path, size_t size) {
+  if (isArchive) {
+    return getFileContent(path).substr(0, size);
+  }
+
+  std::ifstream in(path.c_str(), ::std::ios::binary);
+  if (in) {
+    std::string sample(size, '\0');
+    in.read(&sample[0], size);
+    sample.resize(in.gcount());
+    return sample;
+  }
+  std::cerr << "Unable to open file at path: " << path << std::endl;
+  throw(errno);
+}
+
+/* Reset the incremental parser and feed it the file chunk by chunk,
+   and stop reading as soon as the parser doesn't need more input (the
+   files of an archive are read whole, their data is asked for next) */
+inline void parseFileContent(const std::string &path, GumboPushParser* parser) {
+  if (isArchive) {
+    std::string content = getFileContent(path);
+    gumbo_parser_reset(parser, content.size());
+    gumbo_parser_feed(parser, content.data(), content.size());
+    return;
+  }
+
+  std::ifstream in(path.c_str(), ::std::ios::binary);
+  if (in) {
+    in.seekg(0, std::ios::end);
+    gumbo_parser_reset(parser, in.tellg());
+    in.seekg(0, std::ios::beg);
+    char chunk[65536];
+    do {
+      in.read(chunk, sizeof(chunk));
+    } while (in.gcount() > 0 && gumbo_parser_feed(parser, chunk, in.gcount()));
+    in.close();
+    return;
+  }
+  std::cerr << "Unable to open file at path: " << path << std::endl;
+  throw(errno);
+}
+
 inline unsigned int getFileSize(const std::string &path) {
   struct stat filestatus;
-  stat(path.c_str(), &filestatus);
+  statFile(path, &filestatus);
   return filestatus.st_size;
 }    
 
 inline bool fileExists(const std::string &path) {
+  std::string aid;
+  if (getArchiveAid(path, aid)) {
+    return archiveIndex.find(aid) != archiveIndex.end();
+  }
+  if (!filesFromPath.empty() && path.compare(0, directoryPath.size() + 1, directoryPath + "/") == 0 &&
+      !isListedFile(path.substr(directoryPath.size() + 1))) {
+    return false;
+  }
+
   bool flag = false;
   std::fstream fin;
   fin.open(path.c_str(), std::ios::in);
@@ -268,23 +807,66 @@ bool isFilenameQueueEmpty() {
   return retVal;
 }
 
-void pushToFilenameQueue(const std::string &filename) {
+/* Files pushed to the queue along with their content, by the WARC
+   readers and the socket listener */
+typedef struct {
+  std::string mimeType;
+  std::string title;
+  std::string payload;
+} QueuedFile;
+
+std::map<std::string, QueuedFile> queuedFiles;
+
+void pushToFilenameQueue(const std::string &filename, QueuedFile *file = NULL) {
   unsigned int wait = 0;
   unsigned int queueSize = 0;
 
   do {
     usleep(wait);
     pthread_mutex_lock(&filenameQueueMutex);
-    unsigned queueSize = filenameQueue.size();
+    queueSize = filenameQueue.size();
     pthread_mutex_unlock(&filenameQueueMutex);
     wait += 10;
   } while (queueSize > MAX_QUEUE_SIZE);
 
   pthread_mutex_lock(&filenameQueueMutex);
+  if (file != NULL) {
+    QueuedFile &queuedFile = queuedFiles[filename];
+    queuedFile.mimeType.swap(file->mimeType);
+    queuedFile.title.swap(file->title);
+    queuedFile.payload.swap(file->payload);
+  }
   filenameQueue.push(filename);
   pthread_mutex_unlock(&filenameQueueMutex); 
 }
 
+/* Make the content pushed along with a file the last one read; the
+   files received by the listener are only known from then on */
+inline void takeQueuedFile(const std::string &filename) {
+  std::map<std::string, QueuedFile>::iterator file = queuedFiles.find(filename);
+  std::string aid;
+  if (file == queuedFiles.end() || !getArchiveAid(filename, aid)) {
+    return;
+  }
+  archiveEntryAid = aid;
+  archiveEntryTitle.swap(file->second.title);
+  archiveEntryData.swap(file->second.payload);
+  if (isListening) {
+    ArchiveEntry entry;
+    entry.offset = 0;
+    entry.size = archiveEntryData.size();
+    entry.mtime = time(NULL);
+    archiveIndex[aid] = entry;
+    if (!file->second.mimeType.empty()) {
+      fileMimeTypes[aid] = file->second.mimeType;
+    }
+    if (isFontMimeType(file->second.mimeType)) {
+      archiveFonts[aid] = archiveEntryData;
+    }
+  }
+  queuedFiles.erase(file);
+}
+
 bool popFromFilenameQueue(std::string &filename) {
   bool retVal = false;
   unsigned int wait = 0;
@@ -295,6 +877,7 @@ bool popFromFilenameQueue(std::string &filename) {
       pthread_mutex_lock(&filenameQueueMutex);
       filename = filenameQueue.front();
       filenameQueue.pop();
+      takeQueuedFile(filename);
       pthread_mutex_unlock(&filenameQueueMutex);
       retVal = true;
       break;
@@ -317,10 +900,12 @@ class Article : public zim::writer::Article {
     std::string mimeType;
     std::string redirectAid;
     std::string data;
+    bool compress;
 
   public:
     Article() {
       invalid = false;
+      compress = true;
     }
     explicit Article(const std::string& id);
   
@@ -335,6 +920,38 @@ class Article : public zim::writer::Article {
     virtual bool shouldCompress() const;
 };
 
+/* Title for a page which has none: its file name, without extension
+   and with spaces for underscores */
+static std::string computeTitleFromPath(const std::string &path) {
+  std::string title;
+  std::size_t found = path.rfind("/");
+  if (found!=std::string::npos) {
+    title = path.substr(found+1);
+    found = title.rfind(".");
+    if (found!=std::string::npos) {
+      title = title.substr(0, found);
+    }
+  } else {
+    title = path;
+  }
+  std::replace(title.begin(), title.end(), '_',  ' ');
+  return title;
+}
+
+/* A line of the --redirects file: the path of the redirect, its title
+   (may be empty) and the path of its target, separated by tabs; paths
+   are relative to DIRECTORY like the ones of the files */
+typedef struct {
+  std::string aid;
+  std::string title;
+  std::string target;
+} RedirectRecord;
+
+class RedirectArticle : public Article {
+  public:
+  explicit RedirectArticle(const RedirectRecord &record);
+};
+
 class MetadataArticle : public Article {
   public:
   MetadataArticle(std::string &id) {
@@ -365,6 +982,242 @@ static bool isLocalUrl(const std::string url) {
   return true;
 }
 
+/* Target of a <meta http-equiv="refresh"> from its content attribute */
+static bool getRefreshUrl(const std::string &content, std::string &url) {
+  std::size_t found = content.find("URL=") != std::string::npos ? content.find("URL=") : content.find("url=");
+  if (found!=std::string::npos) {
+    url = content.substr(found+4);
+    return true;
+  }
+  return false;
+}
+
+/* Whether the text is valid UTF-8 without NULs or carriage returns,
+   which the HTML parser would read as is */
+static bool isVerbatimText(const std::string &text) {
+  for (size_t i = 0; i < text.size(); ) {
+    unsigned char c = text[i];
+    size_t length;
+    unsigned int codepoint;
+    if (c == '\0' || c == '\r' || c == '&') {
+      return false;
+    } else if (c < 0x80) {
+      i++;
+      continue;
+    } else if (c >= 0xc2 && c <= 0xdf) {
+      length = 2;
+      codepoint = c & 0x1f;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      length = 3;
+      codepoint = c & 0x0f;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      length = 4;
+      codepoint = c & 0x07;
+    } else {
+      return false;
+    }
+    if (i + length > text.size()) {
+      return false;
+    }
+    for (size_t j = 1; j < length; j++) {
+      unsigned char next = text[i + j];
+      if ((next & 0xc0) != 0x80) {
+	return false;
+      }
+      codepoint = (codepoint << 6) | (next & 0x3f);
+    }
+    /* Overlong forms, surrogates and beyond Unicode */
+    if ((length == 3 && codepoint < 0x800) || (length == 4 && codepoint < 0x10000) ||
+	(codepoint >= 0xd800 && codepoint <= 0xdfff) || codepoint > 0x10ffff) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+inline void skipSpaces(const std::string &html, size_t &pos) {
+  while (pos < html.size() && isSpace(html[pos])) {
+    pos++;
+  }
+}
+
+/* Whether the lowercase word is at pos, in any case */
+inline bool matchWord(const std::string &html, size_t pos, const char *word) {
+  for (; *word; word++, pos++) {
+    if (pos >= html.size() || tolower((unsigned char)html[pos]) != *word) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Read a start or end tag at pos, with its name and attributes in lower
+   case; only the plain forms are accepted: quoted values and names made
+   of letters, digits and dashes */
+static bool scanTag(const std::string &html, size_t &pos, bool &isEndTag, std::string &name,
+		    std::map<std::string, std::string> &attributes) {
+  attributes.clear();
+  name.clear();
+  if (pos >= html.size() || html[pos] != '<') {
+    return false;
+  }
+  pos++;
+  isEndTag = pos < html.size() && html[pos] == '/';
+  if (isEndTag) {
+    pos++;
+  }
+  while (pos < html.size() && isalnum((unsigned char)html[pos])) {
+    name += tolower((unsigned char)html[pos++]);
+  }
+  if (name.empty()) {
+    return false;
+  }
+  while (true) {
+    size_t start = pos;
+    skipSpaces(html, pos);
+    if (pos >= html.size()) {
+      return false;
+    } else if (html[pos] == '>') {
+      pos++;
+      return true;
+    } else if (html.compare(pos, 2, "/>") == 0) {
+      pos += 2;
+      return true;
+    } else if (pos == start || isEndTag) {
+      return false;
+    }
+
+    std::string attributeName;
+    while (pos < html.size() && (isalnum((unsigned char)html[pos]) || html[pos] == '-')) {
+      attributeName += tolower((unsigned char)html[pos++]);
+    }
+    if (attributeName.empty() || attributes.find(attributeName) != attributes.end()) {
+      return false;
+    }
+    skipSpaces(html, pos);
+    if (pos >= html.size() || html[pos] != '=') {
+      return false;
+    }
+    pos++;
+    skipSpaces(html, pos);
+    if (pos >= html.size() || (html[pos] != '"' && html[pos] != '\'')) {
+      return false;
+    }
+    size_t end = html.find(html[pos], pos + 1);
+    if (end == std::string::npos) {
+      return false;
+    }
+    std::string value = html.substr(pos + 1, end - pos - 1);
+    if (!isVerbatimText(value)) {
+      return false;
+    }
+    attributes[attributeName] = value;
+    pos = end + 1;
+  }
+}
+
+/* Recognize a redirect stub page without parsing it: a small page
+   whose <head> only holds a <meta http-equiv="refresh">, maybe a
+   <title> and other <meta> tags, all written so plainly that the HTML
+   parser would read them as they are.  Anything else returns false,
+   and the page is parsed. */
+static bool scanRedirectStub(const std::string &html, std::string &title, std::string &url) {
+  size_t pos = 0;
+  bool isEndTag;
+  bool seenHead = false;
+  bool seenTitle = false;
+  bool seenRefresh = false;
+  std::string name;
+  std::map<std::string, std::string> attributes;
+
+  skipSpaces(html, pos);
+  if (matchWord(html, pos, "<!doctype")) {
+    pos += 9;
+    skipSpaces(html, pos);
+    if (!matchWord(html, pos, "html")) {
+      return false;
+    }
+    pos += 4;
+    skipSpaces(html, pos);
+    if (pos >= html.size() || html[pos] != '>') {
+      return false;
+    }
+    pos++;
+  }
+
+  while (true) {
+    skipSpaces(html, pos);
+    if (pos >= html.size()) {
+      break;
+    }
+    if (!scanTag(html, pos, isEndTag, name, attributes)) {
+      return false;
+    }
+    if (name == "body" && !isEndTag) {
+      break;
+    } else if (isEndTag) {
+      if (name != "head") {
+	return false;
+      }
+      /* Whatever follows is left to the body */
+      skipSpaces(html, pos);
+      if (pos < html.size() && !(matchWord(html, pos, "<body") && pos + 5 < html.size() &&
+				 (isSpace(html[pos + 5]) || html[pos + 5] == '>'))) {
+	return false;
+      }
+      break;
+    } else if (name == "html") {
+      if (seenHead) {
+	return false;
+      }
+    } else if (name == "head") {
+      if (seenHead) {
+	return false;
+      }
+      seenHead = true;
+    } else if (name == "meta") {
+      seenHead = true;
+      std::map<std::string, std::string>::iterator httpEquiv = attributes.find("http-equiv");
+      if (httpEquiv != attributes.end() && httpEquiv->second == "refresh") {
+	std::map<std::string, std::string>::iterator content = attributes.find("content");
+	if (seenRefresh || content == attributes.end() || !getRefreshUrl(content->second, url)) {
+	  return false;
+	}
+	seenRefresh = true;
+      }
+    } else if (name == "title") {
+      seenHead = true;
+      size_t end = pos;
+      while ((end = html.find("</", end)) != std::string::npos && !matchWord(html, end + 2, "title")) {
+	end += 2;
+      }
+      if (seenTitle || end == std::string::npos || end + 8 > html.size() || html[end + 7] != '>') {
+	return false;
+      }
+      title = html.substr(pos, end - pos);
+      if (!isVerbatimText(title) || title.find('<') != std::string::npos) {
+	return false;
+      }
+      /* A blank title would be a whitespace node, not a title */
+      size_t i = 0;
+      skipSpaces(title, i);
+      if (i == title.size() && !title.empty()) {
+	return false;
+      }
+      seenTitle = true;
+      pos = end + 8;
+    } else {
+      return false;
+    }
+  }
+  return seenRefresh;
+}
+
 static std::string extractRedirectUrlFromHtml(const GumboVector* head_children) {
   std::string url;
   
@@ -374,13 +1227,11 @@ static std::string extractRedirectUrlFromHtml(const GumboVector* head_children)
 	child->v.element.tag == GUMBO_TAG_META) {
       GumboAttribute* attribute;
       if (attribute = gumbo_get_attribute(&child->v.element.attributes, "http-equiv")) {
-	if (!strcmp(attribute->value, "refresh")) {
+	GumboStringPiece value = gumbo_attribute_value_piece(attribute);
+	if (value.length == 7 && !strncmp(value.data, "refresh", 7)) {
 	  if (attribute = gumbo_get_attribute(&child->v.element.attributes, "content")) {
-	    std::string targetUrl = attribute->value;
-	    std::size_t found = targetUrl.find("URL=") != std::string::npos ? targetUrl.find("URL=") : targetUrl.find("url=");
-	    if (found!=std::string::npos) {
-	      url = targetUrl.substr(found+4);
-	    } else {
+	    value = gumbo_attribute_value_piece(attribute);
+	    if (!getRefreshUrl(std::string(value.data, value.length), url)) {
 	      throw "Unable to find the target url from the HTML DOM";
 	    }
 	  }
@@ -392,27 +1243,6 @@ static std::string extractRedirectUrlFromHtml(const GumboVector* head_children)
   return url;
 }
 
-static void getLinks(GumboNode* node, std::map<std::string, bool> &links) {
-  if (node->type != GUMBO_NODE_ELEMENT) {
-    return;
-  }
-
-  GumboAttribute* attribute = NULL;
-  attribute = gumbo_get_attribute(&node->v.element.attributes, "href");
-  if (attribute == NULL) {
-    attribute = gumbo_get_attribute(&node->v.element.attributes, "src");
-  }
-
-  if (attribute != NULL && isLocalUrl(attribute->value)) {
-    links[attribute->value] = true;
-  }
-
-  GumboVector* children = &node->v.element.children;
-  for (int i = 0; i < children->length; ++i) {
-    getLinks(static_cast<GumboNode*>(children->data[i]), links);
-  }
-}
-
 static void replaceStringInPlace(std::string& subject, const std::string& search,
 				 const std::string& replace) {
   size_t pos = 0;
@@ -425,6 +1255,12 @@ static void replaceStringInPlace(std::string& subject, const std::string& search
 static std::string getMimeTypeForFile(const std::string& filename) {
   std::string mimeType;
 
+  /* Try to get the mimeType from the cache, which also holds the ones
+     given by the WARC files or the producer */
+  if (fileMimeTypes.find(filename) != fileMimeTypes.end()) {
+    return fileMimeTypes[filename];
+  }
+
   /* Try to get the mimeType from the file extension */
   if (filename.find_last_of(".") != std::string::npos) {
     mimeType = filename.substr(filename.find_last_of(".")+1);
@@ -433,9 +1269,9 @@ static std::string getMimeTypeForFile(const std::string& filename) {
     }
   }
 
-  /* Try to get the mimeType from the cache */
-  if (fileMimeTypes.find(filename) != fileMimeTypes.end()) {
-    return fileMimeTypes[filename];
+  /* Files which aren't on the list aren't looked at */
+  if (!filesFromPath.empty() && !isListedFile(filename)) {
+    return "";
   }
 
   /* Try to get the mimeType with libmagic */
@@ -475,45 +1311,430 @@ inline std::string removeLocalTag(const std::string &url) {
   std::size_t found = url.find("#");
   
   if (found != std::string::npos) {
-    return url.substr(0, found-1);
+    return url.substr(0, found);
   }
   return url;
 }
 
+/* Report the links to files which aren't on the --files-from list, once
+   per file */
+static void checkLinkTarget(const std::string &aid, const std::string &target) {
+  if (!filesFromPath.empty() && !target.empty() && !isListedFile(target) &&
+      unlistedFiles.insert(target).second) {
+    std::cerr << "Link from " << aid << " to " << target << ", which isn't on the file list" << std::endl;
+  }
+}
+
 inline std::string computeNewUrl(const std::string &aid, const std::string &url) {
   std::string filename = computeAbsolutePath(aid, url);
-  std::string targetMimeType = getMimeTypeForFile(removeLocalTag(decodeUrl(filename)));
+  std::string target = removeLocalTag(decodeUrl(filename));
+  checkLinkTarget(aid, target);
+  std::string targetMimeType = getMimeTypeForFile(target);
   std::string originMimeType = getMimeTypeForFile(aid);
   std::string newUrl = "/" + getNamespaceForMimeType(targetMimeType) + "/" + filename;
   std::string baseUrl = "/" + getNamespaceForMimeType(originMimeType) + "/" + aid;
   return computeRelativePath(baseUrl, newUrl);
 }
 
-Article::Article(const std::string& path) {
-  invalid = false;
+/* A link found in an article: the attribute holding it, its URL as a
+   byte range of the HTML (or of the decoded value) and the distinct URL
+   it is an occurrence of */
+typedef struct {
+  GumboAttribute* attribute;
+  const char* url;
+  size_t urlLength;
+  size_t target;
+} LinkRecord;
+
+/* A distinct URL of an article, with the link it first showed up in */
+typedef struct {
+  size_t firstLink;
+  bool isLocal;
+  std::string newUrl;
+} LinkTarget;
+
+/* Work space of rewriteLinks, kept from article to article so that it
+   only grows for the largest ones; only used by the thread pulling the
+   article data for the ZIM creator */
+std::vector<LinkRecord> linkRecords;
+std::vector<LinkTarget> linkTargets;
+std::vector<size_t> linkSlots;
+
+/* FNV-1a */
+static size_t hashUrl(const char* url, size_t length) {
+  size_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)url[i]) * 16777619u;
+  }
+  return hash;
+}
 
-  /* aid */
-  aid = path.substr(directoryPath.size()+1);
+/* Set the target of every link record, adding the URLs not seen yet to
+   linkTargets; linkSlots is an open-addressing hash set of the distinct
+   URLs (indexes in linkTargets plus one, zero being an empty slot) */
+static void deduplicateLinks() {
+  size_t capacity = 16;
+  while (capacity < linkRecords.size() * 2) {
+    capacity *= 2;
+  }
+  linkSlots.assign(capacity, 0);
+  linkTargets.clear();
+
+  for (size_t i = 0; i < linkRecords.size(); i++) {
+    LinkRecord &link = linkRecords[i];
+    size_t slot = hashUrl(link.url, link.urlLength) & (capacity - 1);
+    while (linkSlots[slot] != 0) {
+      const LinkRecord &first = linkRecords[linkTargets[linkSlots[slot] - 1].firstLink];
+      if (first.urlLength == link.urlLength &&
+	  !memcmp(first.url, link.url, link.urlLength)) {
+	break;
+      }
+      slot = (slot + 1) & (capacity - 1);
+    }
+    if (linkSlots[slot] == 0) {
+      linkTargets.push_back(LinkTarget());
+      linkTargets.back().firstLink = i;
+      linkSlots[slot] = linkTargets.size();
+    }
+    link.target = linkSlots[slot] - 1;
+  }
+}
 
-  /* url */
-  url = aid;
+/* Point the local links of the tree to their location in the ZIM file,
+   computing each new URL only once; the distinct local URLs go to
+   localUrls, if not NULL, each followed by a NUL */
+static void rewriteLinks(const GumboOptions* options, GumboNode* root, const std::string &aid,
+			 std::string *localUrls) {
+  static const char* linkAttributes[] = { "href", "src" };
+
+  /* Collect the links, walking the tree without recursion */
+  linkRecords.clear();
+  for (GumboNode* node = root; node; node = gumbo_next_node(root, node)) {
+    if (node->type != GUMBO_NODE_ELEMENT) {
+      continue;
+    }
+    for (unsigned int i = 0; i < sizeof(linkAttributes) / sizeof(linkAttributes[0]); i++) {
+      GumboAttribute* attribute = gumbo_get_attribute(&node->v.element.attributes, linkAttributes[i]);
+      if (attribute == NULL) {
+	continue;
+      }
+      GumboStringPiece value = gumbo_attribute_value_piece(attribute);
+      if (value.length == 0 || value.data[0] == '#') {
+	continue;
+      }
+      LinkRecord link = { attribute, value.data, value.length, 0 };
+      linkRecords.push_back(link);
+    }
+  }
 
-  /* mime-type */
-  mimeType = getMimeTypeForFile(aid);
-  
-  /* namespace */
-  ns = getNamespaceForMimeType(mimeType)[0];
+  /* Compute the new URLs, then rewrite; the ranges may point into the
+     values being replaced, so they aren't used past this point */
+  deduplicateLinks();
+  for (size_t i = 0; i < linkTargets.size(); i++) {
+    LinkTarget &target = linkTargets[i];
+    const LinkRecord &link = linkRecords[target.firstLink];
+    std::string url(link.url, link.urlLength);
+    target.isLocal = isLocalUrl(url);
+    target.newUrl = target.isLocal ? computeNewUrl(aid, url) : std::string();
+    if (target.isLocal && localUrls != NULL) {
+      localUrls->append(url.c_str(), url.size() + 1);
+    }
+  }
+  for (size_t i = 0; i < linkRecords.size(); i++) {
+    const LinkTarget &target = linkTargets[linkRecords[i].target];
+    if (target.isLocal) {
+      gumbo_attribute_set_value(options, linkRecords[i].attribute, target.newUrl.c_str());
+    }
+  }
+}
 
-  /* HTML specific code */
-  if (mimeType.find("text/html") != std::string::npos) {
-    std::size_t found;
-    std::string html = getFileContent(path);
-    GumboOutput* output = gumbo_parse(html.c_str());
+/* Manifest of the files of a build, written next to the ZIM file when
+   a payload cache is used: a line per file with its path, size, mtime,
+   content hash, mime-type, title, meta refresh URL, the hashes of its
+   rewritten payload and of the new URLs of its links (HTML only) and
+   its compressibility (see sampleCompressibility), separated by tabs;
+   the next build only reads and rewrites the files which changed since,
+   or whose links point to files which did */
+typedef struct {
+  unsigned long long size;
+  long long mtime;
+  std::string contentHash;
+  std::string mimeType;
+  std::string title;
+  std::string redirectUrl;
+  std::string payloadHash;
+  std::string linkHash;
+  std::string compressibility;
+} ManifestEntry;
+
+static const char *manifestHeader = "# zimwriterfs manifest 3";
+std::map<std::string, ManifestEntry> previousManifest;
+std::map<std::string, ManifestEntry> manifest;
+unsigned int unchangedFileCount = 0;
+unsigned int cachedPayloadCount = 0;
+
+/* 64 bit FNV-1a, as 16 hexadecimal digits */
+static uint64_t hashBytes(uint64_t hash, const char *bytes, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static std::string formatHash(uint64_t hash) {
+  char digits[17];
+  snprintf(digits, sizeof(digits), "%016llx", (unsigned long long)hash);
+  return digits;
+}
+
+static std::string hashContent(const char *bytes, size_t length) {
+  return formatHash(hashBytes(14695981039346656037ULL, bytes, length));
+}
+
+static std::string hashFile(const std::string &path) {
+  if (isArchive) {
+    std::string content = getFileContent(path);
+    return hashContent(content.data(), content.size());
+  }
+
+  std::ifstream in(path.c_str(), ::std::ios::binary);
+  if (!in) {
+    std::cerr << "Unable to open file at path: " << path << std::endl;
+    throw(errno);
+  }
+  uint64_t hash = 14695981039346656037ULL;
+  char chunk[65536];
+  do {
+    in.read(chunk, sizeof(chunk));
+    hash = hashBytes(hash, chunk, in.gcount());
+  } while (in.gcount() > 0);
+  return formatHash(hash);
+}
+
+/* Fields are escaped so that titles can hold tabs and line breaks */
+static std::string escapeManifestField(const std::string &field) {
+  std::string escaped;
+  for (size_t i = 0; i < field.size(); i++) {
+    switch (field[i]) {
+    case '\\': escaped += "\\\\"; break;
+    case '\t': escaped += "\\t"; break;
+    case '\n': escaped += "\\n"; break;
+    case '\r': escaped += "\\r"; break;
+    default: escaped += field[i];
+    }
+  }
+  return escaped;
+}
+
+static std::string unescapeManifestField(const std::string &field) {
+  std::string unescaped;
+  for (size_t i = 0; i < field.size(); i++) {
+    if (field[i] == '\\' && i + 1 < field.size()) {
+      switch (field[++i]) {
+      case 't': unescaped += '\t'; break;
+      case 'n': unescaped += '\n'; break;
+      case 'r': unescaped += '\r'; break;
+      default: unescaped += field[i];
+      }
+    } else {
+      unescaped += field[i];
+    }
+  }
+  return unescaped;
+}
+
+/* Load the manifest of the previous build, if there is one; a manifest
+   which can't be read only makes the build a full one */
+static void readManifest(const std::string &manifestPath) {
+  std::ifstream in(manifestPath.c_str());
+  std::string line;
+  if (!in.is_open() || !std::getline(in, line) || line != manifestHeader) {
+    return;
+  }
+  while (std::getline(in, line)) {
+    std::vector<std::string> fields;
+    std::size_t start = 0;
+    std::size_t end;
+    while ((end = line.find('\t', start)) != std::string::npos) {
+      fields.push_back(line.substr(start, end - start));
+      start = end + 1;
+    }
+    fields.push_back(line.substr(start));
+    if (fields.size() != 10) {
+      std::cerr << "Invalid line in " << manifestPath << ", ignoring: " << line << std::endl;
+      continue;
+    }
+    ManifestEntry entry;
+    entry.size = strtoull(fields[1].c_str(), NULL, 10);
+    entry.mtime = strtoll(fields[2].c_str(), NULL, 10);
+    entry.contentHash = fields[3];
+    entry.mimeType = unescapeManifestField(fields[4]);
+    entry.title = unescapeManifestField(fields[5]);
+    entry.redirectUrl = unescapeManifestField(fields[6]);
+    entry.payloadHash = fields[7];
+    entry.linkHash = fields[8];
+    entry.compressibility = fields[9];
+    previousManifest[unescapeManifestField(fields[0])] = entry;
+  }
+}
+
+/* Write the manifest of this build, replacing the previous one once
+   complete */
+static void writeManifest(const std::string &manifestPath) {
+  std::string tmpPath = manifestPath + ".tmp";
+  std::ofstream out(tmpPath.c_str());
+  out << manifestHeader << "\n";
+  for (std::map<std::string, ManifestEntry>::iterator it = manifest.begin(); it != manifest.end(); ++it) {
+    const ManifestEntry &entry = it->second;
+    out << escapeManifestField(it->first) << '\t'
+	<< entry.size << '\t'
+	<< entry.mtime << '\t'
+	<< entry.contentHash << '\t'
+	<< escapeManifestField(entry.mimeType) << '\t'
+	<< escapeManifestField(entry.title) << '\t'
+	<< escapeManifestField(entry.redirectUrl) << '\t'
+	<< entry.payloadHash << '\t'
+	<< entry.linkHash << '\t'
+	<< entry.compressibility << "\n";
+  }
+  out.close();
+  if (out.fail() || rename(tmpPath.c_str(), manifestPath.c_str()) != 0) {
+    std::cerr << "Unable to write manifest " << manifestPath << std::endl;
+    unlink(tmpPath.c_str());
+  }
+}
+
+/* Add the file to the manifest of this build; it is unchanged if its
+   size and mtime, or else its content, are those of the previous build,
+   and then its entry is carried over */
+static ManifestEntry &addToManifest(const std::string &aid, const std::string &path, bool &isUnchanged) {
+  struct stat filestatus;
+  statFile(path, &filestatus);
+
+  ManifestEntry &entry = manifest[aid];
+  std::map<std::string, ManifestEntry>::const_iterator previous = previousManifest.find(aid);
+  isUnchanged = false;
+  if (previous != previousManifest.end() &&
+      previous->second.size == (unsigned long long)filestatus.st_size) {
+    if (previous->second.mtime == (long long)filestatus.st_mtime) {
+      isUnchanged = true;
+    } else {
+      entry.contentHash = hashFile(path);
+      isUnchanged = entry.contentHash == previous->second.contentHash;
+    }
+  }
+
+  if (isUnchanged) {
+    entry = previous->second;
+    unchangedFileCount++;
+  } else {
+    if (entry.contentHash.empty()) {
+      entry.contentHash = hashFile(path);
+    }
+    entry.payloadHash.clear();
+    entry.linkHash.clear();
+    entry.compressibility.clear();
+  }
+  entry.size = filestatus.st_size;
+  entry.mtime = filestatus.st_mtime;
+  return entry;
+}
+
+/* Payloads are stored under their hash, in subdirectories named after
+   its first two digits */
+static std::string getCachedPayloadPath(const std::string &hash) {
+  return cachePath + "/" + hash.substr(0, 2) + "/" + hash;
+}
+
+static bool readCachedPayload(const std::string &hash, std::string &payload) {
+  std::ifstream in(getCachedPayloadPath(hash).c_str(), ::std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  in.seekg(0, std::ios::end);
+  payload.resize(in.tellg());
+  in.seekg(0, std::ios::beg);
+  in.read(&payload[0], payload.size());
+  return !in.fail();
+}
+
+static void writeCachedPayload(const std::string &hash, const char *payload, size_t length) {
+  std::string path = getCachedPayloadPath(hash);
+  if (fileExists(path)) {
+    return;
+  }
+  mkdir((cachePath + "/" + hash.substr(0, 2)).c_str(), 0777);
+  std::string tmpPath = path + ".tmp";
+  std::ofstream out(tmpPath.c_str(), ::std::ios::binary);
+  out.write(payload, length);
+  out.close();
+  if (out.fail() || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::cerr << "Unable to write cached payload " << path << std::endl;
+    unlink(tmpPath.c_str());
+  }
+}
+
+/* Hash of the new URLs of the local links of a page, given as by
+   rewriteLinks; they change with the namespaces of their targets */
+static std::string hashLinks(const std::string &aid, const std::string &localUrls) {
+  uint64_t hash = 14695981039346656037ULL;
+  size_t start = 0;
+  size_t end;
+  while ((end = localUrls.find('\0', start)) != std::string::npos) {
+    std::string newUrl = computeNewUrl(aid, localUrls.substr(start, end - start));
+    hash = hashBytes(hash, newUrl.c_str(), newUrl.size() + 1);
+    start = end + 1;
+  }
+  return formatHash(hash);
+}
+
+/* Whether the cached payload of a page is still right: its links are
+   kept in the cache under the hash of its content, and must lead where
+   they did when it was rewritten */
+static bool hasSameLinks(const std::string &aid, const ManifestEntry &entry) {
+  std::string localUrls;
+  return !entry.linkHash.empty() &&
+    readCachedPayload(entry.contentHash + ".links", localUrls) &&
+    hashLinks(aid, localUrls) == entry.linkHash;
+}
+
+/* Read the title and the meta refresh URL of an HTML page, if any */
+static void readHtmlHead(const std::string &path, std::string &title, std::string &targetUrl) {
+  /* Small pages may be redirect stubs, most of which can do without
+     the parser */
+  std::string content;
+  double startTime = 0;
+  bool isSmall = getFileSize(path) <= MAX_STUB_SIZE;
+  bool isScanned = false;
+  if (isSmall) {
+    startTime = getTime();
+    content = getFileContent(path);
+    isScanned = scanRedirectStub(content, title, targetUrl);
+  }
+
+  if (!isScanned) {
+    /* Only the <head> is needed for the title and the redirect, and
+       errors and line numbers are of no use here */
+    GumboOptions options = kGumboDefaultOptions;
+    options.lean = true;
+    options.stop_after_head = true;
+    options.zero_copy_text = true;
+    options.lazy_attribute_values = true;
+    if (htmlParser == NULL) {
+      htmlParser = gumbo_parser_create(&options, 0);
+    }
+    if (isSmall) {
+      gumbo_parser_reset(htmlParser, content.size());
+      gumbo_parser_feed(htmlParser, content.data(), content.size());
+    } else {
+      parseFileContent(path, htmlParser);
+    }
+    GumboOutput* output = gumbo_parser_finish(htmlParser);
     GumboNode* root = output->root;
 
     /* Search the content of the <title> tag in the HTML */
     assert(root->type == GUMBO_NODE_ELEMENT);
-    assert(root->v.element.children.length >= 2);
+    assert(root->v.element.children.length >= 1);
 
     const GumboVector* root_children = &root->v.element.children;
     GumboNode* head = NULL;
@@ -527,6 +1748,7 @@ Article::Article(const std::string& path) {
     }
     assert(head != NULL);
 
+    title.clear();
     GumboVector* head_children = &head->v.element.children;
     for (int i = 0; i < head_children->length; ++i) {
       GumboNode* child = (GumboNode*)(head_children->data[i]);
@@ -535,28 +1757,245 @@ Article::Article(const std::string& path) {
 	if (child->v.element.children.length == 1) {
 	  GumboNode* title_text = (GumboNode*)(child->v.element.children.data[0]);
 	  assert(title_text->type == GUMBO_NODE_TEXT);
-	  title = title_text->v.text.text;
+	  if (title_text->v.text.text == title_text->v.text.original_text.data) {
+	    title.assign(title_text->v.text.text, title_text->v.text.original_text.length);
+	  } else {
+	    title = title_text->v.text.text;
+	  }
 	}
       }
     }
 
-    /* If no title, then compute one from the filename */
-    if (title.empty()) {
-      found = path.rfind("/");
-      if (found!=std::string::npos) {
-	title = path.substr(found+1);
-	found = title.rfind(".");
-	if (found!=std::string::npos) {
-	  title = title.substr(0, found);
-	}
+    targetUrl = extractRedirectUrlFromHtml(head_children);
+    gumbo_destroy_output(&options, output);
+  }
+
+  if (!targetUrl.empty()) {
+    if (isScanned) {
+      scannedStubCount++;
+      scannedStubSeconds += getTime() - startTime;
+    } else if (isSmall) {
+      parsedStubCount++;
+      parsedStubSeconds += getTime() - startTime;
+    }
+  }
+}
+
+/* Leading bytes of the formats which are compressed already */
+static bool hasCompressedSignature(const std::string &sample) {
+  static const struct {
+    size_t offset;
+    const char *bytes;
+    size_t length;
+  } signatures[] = {
+    { 0, "\x89PNG", 4 },
+    { 0, "\xff\xd8\xff", 3 },
+    { 0, "GIF8", 4 },
+    { 8, "WEBP", 4 },
+    { 0, "\x1f\x8b", 2 },
+    { 0, "PK\x03\x04", 4 },
+    { 0, "\xfd" "7zXZ", 5 },
+    { 0, "\x28\xb5\x2f\xfd", 4 },
+    { 0, "BZh", 3 },
+    { 0, "7z\xbc\xaf\x27\x1c", 6 },
+    { 0, "Rar!", 4 },
+    { 0, "OggS", 4 },
+    { 0, "fLaC", 4 },
+    { 0, "ID3", 3 },
+    { 4, "ftyp", 4 },
+    { 0, "\x1a\x45\xdf\xa3", 4 },
+    { 0, "wOFF", 4 },
+    { 0, "wOF2", 4 },
+  };
+  for (unsigned int i = 0; i < sizeof(signatures) / sizeof(signatures[0]); i++) {
+    if (sample.size() >= signatures[i].offset + signatures[i].length &&
+	sample.compare(signatures[i].offset, signatures[i].length, signatures[i].bytes, signatures[i].length) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Mime-types of formats compressed already, whose files aren't even
+   sampled */
+static bool isPrecompressedMimeType(const std::string &mimeType) {
+  const char *mimeTypes[] = {
+    "image/png", "image/jpeg", "image/gif", "image/webp",
+    "application/ogg", "audio/ogg", "audio/mpeg", "video/mp4", "video/webm", "video/ogg",
+    "application/zip", "application/gzip", "application/x-gzip", "application/x-bzip2",
+    "application/x-xz", "application/zstd", "application/font-woff", "font/woff", "font/woff2"
+  };
+  for (unsigned int i = 0; i < sizeof(mimeTypes) / sizeof(mimeTypes[0]); i++) {
+    if (mimeType == mimeTypes[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Compressibility of a file from its first bytes: "p" for a format
+   compressed already, "s" if there are too few of them to tell, and
+   otherwise their order-0 entropy over 8 bits, a rough estimate of the
+   size of the file once compressed relative to its size */
+static std::string sampleCompressibility(const std::string &path) {
+  std::string sample = getFileSample(path, COMPRESSION_SAMPLE_SIZE);
+  if (hasCompressedSignature(sample)) {
+    return "p";
+  }
+  if (sample.size() < MIN_COMPRESSION_SAMPLE_SIZE) {
+    return "s";
+  }
+
+  unsigned int counts[256];
+  memset(counts, 0, sizeof(counts));
+  for (size_t i = 0; i < sample.size(); i++) {
+    counts[(unsigned char)sample[i]]++;
+  }
+  double entropy = 0;
+  for (unsigned int i = 0; i < 256; i++) {
+    if (counts[i] > 0) {
+      double probability = (double)counts[i] / sample.size();
+      entropy -= probability * log(probability) / log(2.0);
+    }
+  }
+  std::ostringstream ratio;
+  ratio << std::fixed << std::setprecision(3) << entropy / 8;
+  return ratio.str();
+}
+
+/* Whether to put a file in a compressed cluster: as --compress and
+   --no-compress say for its mime-type, else not for the formats which
+   are compressed already, else if its sample looks compressible (or is
+   too small to tell: small files cost little, compressed along with
+   others) */
+static bool computeShouldCompress(const std::string &path, const std::string &mimeType,
+				  ManifestEntry *entry, bool isUnchanged) {
+  std::string baseMimeType = mimeType.substr(0, mimeType.find(';'));
+  unsigned long long size = getFileSize(path);
+  bool compress;
+  double ratio = 1;
+
+  std::map<std::string, bool>::const_iterator override = compressionOverrides.find(baseMimeType);
+  if (override == compressionOverrides.end()) {
+    override = compressionOverrides.find(baseMimeType.substr(0, baseMimeType.find('/')) + "/*");
+  }
+  if (override != compressionOverrides.end()) {
+    compress = override->second;
+  } else if (isPrecompressedMimeType(baseMimeType)) {
+    compress = false;
+    precompressedFileCount++;
+  } else {
+    std::string compressibility;
+    if (entry != NULL && isUnchanged && !entry->compressibility.empty()) {
+      compressibility = entry->compressibility;
+    } else {
+      compressibility = sampleCompressibility(path);
+      if (entry != NULL) {
+	entry->compressibility = compressibility;
+      }
+    }
+    if (compressibility == "p") {
+      compress = false;
+      precompressedFileCount++;
+    } else if (compressibility == "s") {
+      compress = true;
+    } else {
+      ratio = atof(compressibility.c_str());
+      compress = ratio <= MAX_COMPRESSION_RATIO;
+    }
+  }
+
+  if (compress) {
+    compressedFileCount++;
+    compressedFileSize += size;
+    if (mimeType.find("text") != 0) {
+      nonTextCompressedFileCount++;
+      nonTextCompressedFileSize += size;
+      nonTextSavedSize += size * (1 - ratio);
+    }
+  } else {
+    storedFileCount++;
+    storedFileSize += size;
+  }
+  return compress;
+}
+
+Article::Article(const std::string& path) {
+  invalid = false;
+  compress = true;
+
+  /* aid */
+  aid = path.substr(directoryPath.size()+1);
+
+  /* url */
+  url = aid;
+
+  /* Files of the --files-from list are only looked for now */
+  struct stat filestatus;
+  if (!filesFromPath.empty() && (stat(path.c_str(), &filestatus) != 0 || !S_ISREG(filestatus.st_mode))) {
+    std::cerr << "Skipping " << aid << ", which is on the file list but isn't a file of " << directoryPath << std::endl;
+    invalid = true;
+    return;
+  }
+
+  /* 3xx responses of WARC files */
+  if (isWarc) {
+    std::map<std::string, ArchiveEntry>::const_iterator entry = archiveIndex.find(aid);
+    if (entry != archiveIndex.end() && !entry->second.redirectAid.empty()) {
+      mimeType = getMimeTypeForFile(aid);
+      ns = getNamespaceForMimeType(mimeType)[0];
+      title = computeTitleFromPath(aid);
+      if (archiveIndex.find(entry->second.redirectAid) != archiveIndex.end()) {
+	redirectAid = entry->second.redirectAid;
       } else {
-	title = path;
+	invalid = true;
       }
-      std::replace(title.begin(), title.end(), '_',  ' ');
+      return;
+    }
+  }
+
+  /* Take the mime-type, title and redirect from the manifest of the
+     previous build if the file didn't change since */
+  std::string targetUrl;
+  ManifestEntry *entry = NULL;
+  bool isUnchanged = false;
+  if (!cachePath.empty()) {
+    entry = &addToManifest(aid, path, isUnchanged);
+  }
+
+  if (isUnchanged) {
+    mimeType = entry->mimeType;
+    title = entry->title;
+    targetUrl = entry->redirectUrl;
+  } else {
+    /* mime-type */
+    mimeType = getMimeTypeForFile(aid);
+
+    if (isListening && aid == archiveEntryAid && !archiveEntryTitle.empty()) {
+      /* Given by the producer */
+      title = archiveEntryTitle;
+    } else if (mimeType.find("text/html") != std::string::npos) {
+      /* HTML specific code */
+      readHtmlHead(path, title, targetUrl);
+    }
+
+    if (entry != NULL) {
+      entry->mimeType = mimeType;
+      entry->title = title;
+      entry->redirectUrl = targetUrl;
+    }
+  }
+  
+  /* namespace */
+  ns = getNamespaceForMimeType(mimeType)[0];
+
+  if (mimeType.find("text/html") != std::string::npos) {
+    /* If no title, then compute one from the filename */
+    if (title.empty()) {
+      title = computeTitleFromPath(path);
     }
 
     /* Detect if this is a redirection */    
-    std::string targetUrl = extractRedirectUrlFromHtml(head_children);
     if (!targetUrl.empty()) {
       redirectAid = computeAbsolutePath(aid, decodeUrl(targetUrl));
       if (!fileExists(directoryPath + "/" + redirectAid)) {
@@ -564,11 +2003,22 @@ Article::Article(const std::string& path) {
 	invalid = true;
       }
     }
+  }
 
-    gumbo_destroy_output(&kGumboDefaultOptions, output);
+  if (!invalid && redirectAid.empty()) {
+    compress = computeShouldCompress(path, mimeType, entry, isUnchanged);
   }
 }
 
+RedirectArticle::RedirectArticle(const RedirectRecord &record) {
+  aid = record.aid;
+  url = aid;
+  mimeType = getMimeTypeForFile(aid);
+  ns = getNamespaceForMimeType(mimeType)[0];
+  title = record.title.empty() ? computeTitleFromPath(aid) : record.title;
+  redirectAid = record.target;
+}
+
 std::string Article::getAid() const
 {
   return aid;
@@ -610,7 +2060,7 @@ std::string Article::getRedirectAid() const
 }
 
 bool Article::shouldCompress() const {
-  return (getMimeType().find("text") == 0 ? true : false);
+  return compress;
 }
 
 /* ArticleSource class */
@@ -629,6 +2079,114 @@ std::string ArticleSource::getMainPage() {
   return welcome;
 }
 
+/* Redirects of the --redirects file, read a batch at a time once all
+   the files have been added; their targets are checked against the
+   paths of those files rather than looked up on the file system */
+static const size_t redirectBatchSize = 65536;
+std::ifstream redirectsStream;
+std::vector<RedirectRecord> redirectBatch;
+size_t redirectBatchPosition = 0;
+std::vector<std::string> articlePaths;
+bool articlePathsSorted = false;
+
+/* Redirects sent to the listener, which go before the ones of the file */
+std::vector<RedirectRecord> listenedRedirects;
+size_t listenedRedirectPosition = 0;
+
+/* Orders the records of redirectBatch by target */
+struct RedirectTargetLess {
+  bool operator()(size_t a, size_t b) const {
+    return redirectBatch[a].target < redirectBatch[b].target;
+  }
+};
+
+static bool parseRedirectRecord(const std::string &line, RedirectRecord &record) {
+  std::size_t first = line.find('\t');
+  std::size_t last = line.rfind('\t');
+  if (first == std::string::npos || first == 0 || last + 1 == line.size()) {
+    return false;
+  }
+  record.aid = line.substr(0, first);
+  record.title = first == last ? "" : line.substr(first + 1, last - first - 1);
+  record.target = line.substr(last + 1);
+  return true;
+}
+
+/* Read the next batch of redirects, dropping the ones whose target isn't
+   a file of DIRECTORY or whose path is one; false once the file is done */
+static bool readRedirectBatch() {
+  std::string line;
+  RedirectRecord record;
+
+  redirectBatch.clear();
+  redirectBatchPosition = 0;
+  while (redirectBatch.size() < redirectBatchSize && listenedRedirectPosition < listenedRedirects.size()) {
+    redirectBatch.push_back(listenedRedirects[listenedRedirectPosition++]);
+  }
+  while (redirectBatch.size() < redirectBatchSize && std::getline(redirectsStream, line)) {
+    if (!line.empty() && line[line.size()-1] == '\r') {
+      line.erase(line.size()-1);
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (parseRedirectRecord(line, record)) {
+      redirectBatch.push_back(record);
+    } else {
+      std::cerr << "Invalid line in " << redirectsPath << ": " << line << std::endl;
+    }
+  }
+  if (redirectBatch.empty()) {
+    return false;
+  }
+
+  /* Look the targets up in sorted order, so that each search starts
+     where the previous one ended */
+  std::vector<size_t> order(redirectBatch.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), RedirectTargetLess());
+  std::vector<bool> valid(redirectBatch.size(), false);
+  std::vector<std::string>::iterator position = articlePaths.begin();
+  for (size_t i = 0; i < order.size(); i++) {
+    const RedirectRecord &redirect = redirectBatch[order[i]];
+    position = std::lower_bound(position, articlePaths.end(), redirect.target);
+    if (position == articlePaths.end() || *position != redirect.target) {
+      std::cerr << "Unable to find the target of redirect " << redirect.aid << ": " << redirect.target << std::endl;
+    } else if (std::binary_search(articlePaths.begin(), articlePaths.end(), redirect.aid)) {
+      std::cerr << "Redirect " << redirect.aid << " has the path of a file, skipping it" << std::endl;
+    } else {
+      valid[order[i]] = true;
+    }
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < redirectBatch.size(); i++) {
+    if (valid[i]) {
+      if (kept != i) {
+	redirectBatch[kept] = redirectBatch[i];
+      }
+      kept++;
+    }
+  }
+  redirectBatch.resize(kept);
+  return true;
+}
+
+static Article *getNextRedirect() {
+  if (!articlePathsSorted) {
+    std::sort(articlePaths.begin(), articlePaths.end());
+    articlePathsSorted = true;
+  }
+  while (redirectBatchPosition == redirectBatch.size()) {
+    if (!readRedirectBatch()) {
+      return NULL;
+    }
+  }
+  return new RedirectArticle(redirectBatch[redirectBatchPosition++]);
+}
+
 Article *article = NULL;
 const zim::writer::Article* ArticleSource::getNextArticle() {
   std::string path;
@@ -641,12 +2199,23 @@ const zim::writer::Article* ArticleSource::getNextArticle() {
     path = metadataQueue.front();
     metadataQueue.pop();
     article = new MetadataArticle(path);
-  } else if (popFromFilenameQueue(path)) {
-    do {
-      article = new Article(path);
-    } while (article && article->isInvalid() && popFromFilenameQueue(path));
   } else {
+    /* Skip the invalid articles, up to the last one */
     article = NULL;
+    while (article == NULL && popFromFilenameQueue(path)) {
+      article = new Article(path);
+      if (article->isInvalid()) {
+	delete(article);
+	article = NULL;
+      } else if (!redirectsPath.empty() || isListening) {
+	/* Only the files which make it into the ZIM file may be
+	   redirected to */
+	articlePaths.push_back(path.substr(directoryPath.size()+1));
+      }
+    }
+    if (article == NULL && (!redirectsPath.empty() || isListening)) {
+      article = getNextRedirect();
+    }
   }
 
   /* Count mimetypes */
@@ -706,28 +2275,47 @@ zim::Blob ArticleSource::getData(const std::string& aid) {
   } else {
     std::string aidPath = directoryPath + "/" + aid;
     
-    if (getMimeTypeForFile(aid).find("text/html") == 0) {
+    ManifestEntry *entry = NULL;
+    std::string payload;
+    if (!cachePath.empty() && manifest.find(aid) != manifest.end()) {
+      entry = &manifest[aid];
+    }
+
+    if (entry != NULL && !entry->payloadHash.empty() &&
+	hasSameLinks(aid, *entry) &&
+	readCachedPayload(entry->payloadHash, payload)) {
+      /* Rewritten by a previous build */
+      dataSize = payload.size();
+      data = new char[dataSize];
+      memcpy(data, payload.data(), dataSize);
+      cachedPayloadCount++;
+    } else if (getMimeTypeForFile(aid).find("text/html") == 0) {
       std::string html = getFileContent(aidPath);
       
-      /* Rewrite links (src|href|...) attributes */
-      GumboOutput* output = gumbo_parse(html.c_str());
-      GumboNode* root = output->root;
-
-      std::map<std::string, bool> links;
-      getLinks(root, links);
-      std::map<std::string, bool>::iterator it;
-      std::string aidDirectory = removeLastPathElement(aid, false, false);
-      for(it = links.begin(); it != links.end(); it++) {
-	if (!it->first.empty() && it->first[0] != '#') {
-	  replaceStringInPlace(html, "\"" + it->first + "\"", "\"" + computeNewUrl(aid, it->first) + "\"");
-	  replaceStringInPlace(html, "\'" + it->first + "\'", "\'" + computeNewUrl(aid, it->first) + "\'");
-	}
-      }
-      gumbo_destroy_output(&kGumboDefaultOptions, output);
-
-      dataSize = html.length();
+      /* Rewrite links (src|href) attributes in the tree and write it
+	 back out; everything else is copied from the source as is */
+      GumboOptions options = kGumboDefaultOptions;
+      options.lean = true;
+      options.zero_copy_text = true;
+      options.lazy_attribute_values = true;
+      GumboOutput* output = gumbo_parse_with_options(&options, html.c_str(), html.size());
+      std::string localUrls;
+      rewriteLinks(&options, output->document, aid, entry != NULL ? &localUrls : NULL);
+      GumboHtmlBuffer buffer = { NULL, 0, 0 };
+      gumbo_serialize(&options, output->document, &buffer);
+
+      dataSize = buffer.length;
       data = new char[dataSize];
-      memcpy(data, html.c_str(), dataSize);
+      memcpy(data, buffer.data, dataSize);
+      gumbo_destroy_html_buffer(&options, &buffer);
+      gumbo_destroy_output(&options, output);
+
+      if (entry != NULL) {
+	entry->payloadHash = hashContent(data, dataSize);
+	writeCachedPayload(entry->payloadHash, data, dataSize);
+	entry->linkHash = hashLinks(aid, localUrls);
+	writeCachedPayload(entry->contentHash + ".links", localUrls.data(), localUrls.size());
+      }
     } else if (getMimeTypeForFile(aid).find("text/css") == 0) {
       std::string css = getFileContent(aidPath);
 
@@ -748,9 +2336,10 @@ zim::Blob ArticleSource::getData(const std::string& aid) {
 	  /* Embeded fonts need to be inline because Kiwix is
 	     otherwise not able to load same because of the
 	     same-origin security */
-	  if (mimeType == "application/font-ttf" || 
-	      mimeType == "application/font-woff" || 
-	      mimeType == "application/vnd.ms-opentype") {
+	  if ((mimeType == "application/font-ttf" || 
+	       mimeType == "application/font-woff" || 
+	       mimeType == "application/vnd.ms-opentype") &&
+	      (filesFromPath.empty() || isListedFile(computeAbsolutePath(aid, url)))) {
 	    std::string fontPath = directoryPath + "/" + computeAbsolutePath(aid, url);
 	    std::string fontContent = getFileContent(fontPath);
 	    replaceStringInPlace(css, url, "data:" + mimeType + ";base64," + base64_encode(reinterpret_cast<const unsigned char*>(fontContent.c_str()), fontContent.length()));
@@ -774,10 +2363,543 @@ zim::Blob ArticleSource::getData(const std::string& aid) {
 }
 
 /* Non ZIM related code */
+
+/* Comma-separated mime-types of --compress or --no-compress */
+static void addCompressionOverrides(const std::string &mimeTypes, bool compress) {
+  std::size_t start = 0;
+  while (start <= mimeTypes.size()) {
+    std::size_t end = mimeTypes.find(',', start);
+    if (end == std::string::npos) {
+      end = mimeTypes.size();
+    }
+    if (end > start) {
+      compressionOverrides[mimeTypes.substr(start, end - start)] = compress;
+    }
+    start = end + 1;
+  }
+}
+
 void usage() {
-  std::cout << "zimwriterfs --welcome=html/index.html --favicon=media/favicon.png --language=fra --title=foobar --description=mydescription --creator=Wikipedia --publisher=Kiwix [--minChunkSize=1024] DIRECTORY ZIM" << std::endl;
+  std::cout << "zimwriterfs --welcome=html/index.html --favicon=media/favicon.png --language=fra --title=foobar --description=mydescription --creator=Wikipedia --publisher=Kiwix [--minChunkSize=1024] [--redirects=redirects.tsv] [--cache=DIRECTORY] [--listen=unix:PATH] [--files-from=-] [--compress=TYPES] [--no-compress=TYPES] [--order=directory|content] [--popularity=FILE] [--writer=native [--threads=N] [--max-memory=MiB]] DIRECTORY ZIM" << std::endl;
+  std::cout << "zimwriterfs [options] WARC... ZIM" << std::endl;
   std::cout << "\tDIRECTORY is the path of the directory containing the HTML pages you want to put in the ZIM file," << std::endl;
+  std::cout << "\t          or of a tar archive of it, possibly compressed with gzip or zstd." << std::endl;
+  std::cout << "\t          It may also be replaced by one or several WARC files (.warc, .warc.gz or .warc.zst), their" << std::endl;
+  std::cout << "\t          responses being put at HOST/PATH of their URI and the 3xx ones becoming redirects." << std::endl;
+  std::cout << "\t--listen=unix:PATH replaces DIRECTORY by the files a producer sends to the Unix socket PATH, see" << std::endl;
+  std::cout << "\t          zimwriterfs-client.js for the protocol." << std::endl;
+  std::cout << "\t--files-from is the path of a list (- for the standard input) of the files of DIRECTORY to add, instead of all of them:" << std::endl;
+  std::cout << "\t          relative paths, each followed by a NUL, optionally with a tab and a mime-type before it." << std::endl;
   std::cout << "\tZIM       is the path of the ZIM file you want to obtain." << std::endl;
+  std::cout << "\t--redirects is the path of a file listing redirects, one per line: path, title (may be empty) and target path, separated by tabs." << std::endl;
+  std::cout << "\t            Paths are relative to DIRECTORY; this is much faster than redirect pages with a <meta http-equiv=\"refresh\">." << std::endl;
+  std::cout << "\t--cache is the path of a directory keeping the rewritten HTML pages from one build to the next; ZIM.manifest then lists" << std::endl;
+  std::cout << "\t            the files of the build, and the next one only reads and rewrites those which changed, or link to files which did." << std::endl;
+  std::cout << "\t--compress and --no-compress are comma-separated mime-types (or \"type/*\") whose files are always, or never, compressed;" << std::endl;
+  std::cout << "\t            the others are compressed unless their first bytes show an already compressed format or look incompressible." << std::endl;
+  std::cout << "\t--order sorts the files of DIRECTORY by namespace and mime-type, then by directory or, for text files, by the" << std::endl;
+  std::cout << "\t            MinHash of their words, so that related files share clusters; the default is the order of readdir." << std::endl;
+  std::cout << "\t            The sort goes to disk beyond 64 MiB, or a quarter of --max-memory." << std::endl;
+  std::cout << "\t--popularity is the path of a file ranking files of DIRECTORY, one per line: path and score (a number of" << std::endl;
+  std::cout << "\t            requests, say), separated by a tab. They come first, highest score first, to share the first clusters." << std::endl;
+  std::cout << "\t--writer=native writes the ZIM file with the built-in writer instead of zimlib's, compressing the clusters" << std::endl;
+  std::cout << "\t            on --threads threads (default: one per processor); the file is the same whatever their number." << std::endl;
+  std::cout << "\t            --max-memory caps the memory taken by the directory of the ZIM file, which is sorted on disk" << std::endl;
+  std::cout << "\t            beyond it; the clusters being compressed take about 4 times --minchunksize more per thread." << std::endl;
+}
+
+/* WARC files: their response records are the files, at the path
+   "HOST/PATH" of their URI (with index.html for the directories), the
+   way a mirroring crawler lays them out; 3xx responses are redirects.
+   Each WARC file is indexed, then read, by its own thread, and only the
+   payloads of the files in the queue are kept in memory */
+typedef struct {
+  InputStream stream;
+  pthread_t thread;
+  std::vector<std::string> paths;
+  std::vector<ArchiveEntry> entries;
+  std::vector<std::string> mimeTypes;
+  std::map<std::string, std::string> fonts;
+} WarcFile;
+
+std::vector<WarcFile> warcFiles;
+
+inline bool isWarcPath(const std::string &path) {
+  const char *extensions[] = { ".warc", ".warc.gz", ".warc.zst" };
+  for (unsigned int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+    size_t length = strlen(extensions[i]);
+    if (path.size() > length && path.compare(path.size() - length, length, extensions[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static std::string toLower(const std::string &text) {
+  std::string lower = text;
+  for (size_t i = 0; i < lower.size(); i++) {
+    lower[i] = tolower((unsigned char)lower[i]);
+  }
+  return lower;
+}
+
+/* Split a "Name: value" header line, with a lowercase name */
+static bool parseHeaderLine(const std::string &line, std::string &name, std::string &value) {
+  size_t colon = line.find(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+  name = toLower(line.substr(0, colon));
+  size_t start = line.find_first_not_of(" \t", colon + 1);
+  size_t end = line.find_last_not_of(" \t");
+  value = start == std::string::npos ? "" : line.substr(start, end - start + 1);
+  return true;
+}
+
+/* ZIM path of an absolute URI */
+static std::string computePathFromUri(const std::string &uri) {
+  std::string rest = uri.substr(0, uri.find('#'));
+  size_t scheme = rest.find("://");
+  if (scheme != std::string::npos) {
+    rest = rest.substr(scheme + 3);
+  }
+  size_t slash = rest.find_first_of("/?");
+  std::string host = toLower(rest.substr(0, slash));
+  std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+  if (host.size() > 3 && host.compare(host.size() - 3, 3, ":80") == 0) {
+    host.erase(host.size() - 3);
+  } else if (host.size() > 4 && host.compare(host.size() - 4, 4, ":443") == 0) {
+    host.erase(host.size() - 4);
+  }
+  std::string query;
+  size_t question = path.find('?');
+  if (question != std::string::npos) {
+    query = path.substr(question);
+    path = path.substr(0, question);
+  }
+
+  /* Resolve the dot segments */
+  std::vector<std::string> segments;
+  std::stringstream pathStream(path);
+  std::string segment;
+  while (std::getline(pathStream, segment, '/')) {
+    if (segment == "..") {
+      if (!segments.empty()) {
+	segments.pop_back();
+      }
+    } else if (!segment.empty() && segment != ".") {
+      segments.push_back(decodeUrl(segment));
+    }
+  }
+  bool isDirectory = path.empty() || path[path.size()-1] == '/' ||
+    segment == "." || segment == "..";
+
+  std::string zimPath = host;
+  for (size_t i = 0; i < segments.size(); i++) {
+    zimPath += "/" + segments[i];
+  }
+  if (isDirectory) {
+    zimPath += "/index.html";
+  }
+  return zimPath + query;
+}
+
+/* ZIM path of the Location of a redirect */
+static std::string computeRedirectPath(const std::string &uri, const std::string &location) {
+  size_t scheme = uri.find("://");
+  std::string schemeName = scheme == std::string::npos ? "http" : uri.substr(0, scheme);
+  size_t authorityEnd = uri.find_first_of("/?#", scheme == std::string::npos ? 0 : scheme + 3);
+  std::string authority = uri.substr(0, authorityEnd);
+
+  if (location.find("://") != std::string::npos) {
+    return computePathFromUri(location);
+  } else if (location.compare(0, 2, "//") == 0) {
+    return computePathFromUri(schemeName + ":" + location);
+  } else if (!location.empty() && location[0] == '/') {
+    return computePathFromUri(authority + location);
+  }
+  std::string base = uri.substr(0, uri.find_first_of("?#"));
+  size_t lastSlash = base.rfind('/');
+  if (lastSlash == std::string::npos || lastSlash < authority.size()) {
+    base = authority + "/";
+  } else {
+    base = base.substr(0, lastSlash + 1);
+  }
+  return computePathFromUri(base + location);
+}
+
+/* "2014-01-31T12:34:56Z" */
+static long long parseWarcDate(const std::string &date) {
+  struct tm time;
+  memset(&time, 0, sizeof(time));
+  if (sscanf(date.c_str(), "%d-%d-%dT%d:%d:%d", &time.tm_year, &time.tm_mon, &time.tm_mday,
+	     &time.tm_hour, &time.tm_min, &time.tm_sec) < 3) {
+    return 0;
+  }
+  time.tm_year -= 1900;
+  time.tm_mon -= 1;
+  return timegm(&time);
+}
+
+/* First pass over a WARC file: index its response records from their
+   WARC and HTTP headers, and keep the fonts */
+void *indexWarcFile(void *data) {
+  WarcFile &warc = *(WarcFile*)data;
+  InputStream &stream = warc.stream;
+  size_t input = &warc - &warcFiles[0];
+  std::string line;
+  std::string name;
+  std::string value;
+
+  openInputStream(stream);
+  while (readInputLine(stream, line, (unsigned long long)-1)) {
+    if (line.empty()) {
+      continue;
+    }
+    if (line.compare(0, 5, "WARC/") != 0) {
+      std::cerr << stream.path << " is not a WARC file, or is corrupted" << std::endl;
+      exit(1);
+    }
+
+    /* WARC headers */
+    std::string type;
+    std::string uri;
+    std::string date;
+    std::string blockType;
+    unsigned long long length = 0;
+    while (readInputLine(stream, line, (unsigned long long)-1) && !line.empty()) {
+      if (parseHeaderLine(line, name, value)) {
+	if (name == "warc-type") {
+	  type = value;
+	} else if (name == "warc-target-uri") {
+	  uri = value[0] == '<' ? value.substr(1, value.size() - 2) : value;
+	} else if (name == "warc-date") {
+	  date = value;
+	} else if (name == "content-type") {
+	  blockType = toLower(value);
+	} else if (name == "content-length") {
+	  length = strtoull(value.c_str(), NULL, 10);
+	}
+      }
+    }
+    unsigned long long blockEnd = stream.position + length;
+
+    if (type == "response" && blockType.compare(0, 16, "application/http") == 0 && !uri.empty()) {
+      /* HTTP status and headers */
+      int status = 0;
+      std::string mimeType;
+      std::string location;
+      std::string contentEncoding;
+      bool isChunked = false;
+      if (readInputLine(stream, line, blockEnd) && line.compare(0, 5, "HTTP/") == 0) {
+	status = atoi(line.c_str() + line.find(' ') + 1);
+      }
+      while (readInputLine(stream, line, blockEnd) && !line.empty()) {
+	if (parseHeaderLine(line, name, value)) {
+	  if (name == "content-type") {
+	    mimeType = toLower(value.substr(0, value.find(';')));
+	    mimeType = mimeType.substr(0, mimeType.find_last_not_of(" \t") + 1);
+	  } else if (name == "location") {
+	    location = value;
+	  } else if (name == "content-encoding") {
+	    contentEncoding = toLower(value);
+	  } else if (name == "transfer-encoding") {
+	    isChunked = toLower(value).find("chunked") != std::string::npos;
+	  }
+	}
+      }
+
+      ArchiveEntry entry;
+      entry.offset = stream.position;
+      entry.length = blockEnd - stream.position;
+      entry.size = entry.length;
+      entry.mtime = parseWarcDate(date);
+      entry.input = input;
+      entry.isChunked = isChunked;
+      std::string path = computePathFromUri(uri);
+      std::string content;
+      bool isValid = false;
+
+      if (status >= 300 && status < 400 && !location.empty()) {
+	entry.redirectAid = computeRedirectPath(uri, location);
+	entry.size = 0;
+	isValid = entry.redirectAid != path;
+      } else if (status == 200 && (contentEncoding.empty() || contentEncoding == "identity")) {
+	isValid = true;
+	if (isChunked || isFontMimeType(mimeType)) {
+	  readInputString(stream, content, entry.length);
+	  if (isChunked) {
+	    std::string body;
+	    body.swap(content);
+	    isValid = decodeChunked(body, content);
+	    entry.size = content.size();
+	  }
+	}
+      } else if (status == 200) {
+	std::cerr << "Skipping " << uri << ", sent with Content-Encoding: " << contentEncoding << std::endl;
+      }
+
+      if (isValid) {
+	warc.paths.push_back(path);
+	warc.entries.push_back(entry);
+	warc.mimeTypes.push_back(mimeType.empty() ? "application/octet-stream" : mimeType);
+	if (isFontMimeType(mimeType)) {
+	  warc.fonts[path] = content;
+	}
+      }
+    }
+
+    seekInputStream(stream, blockEnd);
+  }
+  closeInputStream(stream);
+  return NULL;
+}
+
+/* Index the WARC files in parallel, then merge their indexes; the first
+   record of a path is the one kept */
+static void indexWarcFiles() {
+  std::cout << "Indexing " << warcPaths.size() << " WARC files" << std::endl;
+  warcFiles.resize(warcPaths.size());
+  for (size_t i = 0; i < warcFiles.size(); i++) {
+    warcFiles[i].stream.path = warcPaths[i];
+    warcFiles[i].stream.decompressor = getDecompressor(warcPaths[i]);
+    warcFiles[i].stream.file = NULL;
+    pthread_create(&warcFiles[i].thread, NULL, indexWarcFile, &warcFiles[i]);
+  }
+
+  for (size_t i = 0; i < warcFiles.size(); i++) {
+    WarcFile &warc = warcFiles[i];
+    pthread_join(warc.thread, NULL);
+
+    size_t kept = 0;
+    for (size_t j = 0; j < warc.paths.size(); j++) {
+      if (archiveIndex.find(warc.paths[j]) == archiveIndex.end()) {
+	archiveIndex[warc.paths[j]] = warc.entries[j];
+	fileMimeTypes[warc.paths[j]] = warc.mimeTypes[j];
+	warc.paths[kept] = warc.paths[j];
+	warc.entries[kept] = warc.entries[j];
+	kept++;
+      }
+    }
+    warc.paths.resize(kept);
+    warc.entries.resize(kept);
+    std::vector<std::string>().swap(warc.mimeTypes);
+    archiveFonts.insert(warc.fonts.begin(), warc.fonts.end());
+    std::map<std::string, std::string>().swap(warc.fonts);
+  }
+  std::cout << "Found " << archiveIndex.size() << " records in " << warcPaths.size() << " WARC files" << std::endl;
+}
+
+/* The files of the WARC files go to the queue in the order of the
+   WARC files, whichever thread reads faster: the threads of the next
+   ones read up to MAX_QUEUE_SIZE files ahead until their turn comes */
+size_t warcTurn = 0;
+
+static bool isWarcTurn(const WarcFile &warc) {
+  pthread_mutex_lock(&filenameQueueMutex);
+  bool retVal = warcTurn < warcFiles.size() && &warcFiles[warcTurn] == &warc;
+  pthread_mutex_unlock(&filenameQueueMutex);
+  return retVal;
+}
+
+static void waitForWarcTurn(const WarcFile &warc) {
+  unsigned int wait = 0;
+  while (!isWarcTurn(warc)) {
+    usleep(wait);
+    wait += 10;
+  }
+}
+
+static void pushWarcFiles(const WarcFile &warc, std::deque<size_t> &indexes, std::deque<QueuedFile> &files) {
+  for (; !indexes.empty(); indexes.pop_front(), files.pop_front()) {
+    size_t i = indexes.front();
+    pushToFilenameQueue(directoryPath + "/" + warc.paths[i], warc.entries[i].redirectAid.empty() ? &files.front() : NULL);
+  }
+}
+
+/* Second pass over a WARC file: read the payloads of its records */
+void *readWarcFile(void *data) {
+  WarcFile &warc = *(WarcFile*)data;
+  InputStream &stream = warc.stream;
+  std::deque<size_t> indexes;
+  std::deque<QueuedFile> files;
+
+  openInputStream(stream);
+  for (size_t i = 0; i < warc.paths.size(); i++) {
+    const ArchiveEntry &entry = warc.entries[i];
+    indexes.push_back(i);
+    files.push_back(QueuedFile());
+    if (entry.redirectAid.empty()) {
+      QueuedFile &file = files.back();
+      seekInputStream(stream, entry.offset);
+      readInputString(stream, file.payload, entry.length);
+      if (entry.isChunked) {
+	std::string body;
+	body.swap(file.payload);
+	decodeChunked(body, file.payload);
+      }
+    }
+    if (indexes.size() > MAX_QUEUE_SIZE) {
+      waitForWarcTurn(warc);
+    }
+    if (isWarcTurn(warc)) {
+      pushWarcFiles(warc, indexes, files);
+    }
+  }
+  closeInputStream(stream);
+
+  waitForWarcTurn(warc);
+  pushWarcFiles(warc, indexes, files);
+  pthread_mutex_lock(&filenameQueueMutex);
+  warcTurn++;
+  pthread_mutex_unlock(&filenameQueueMutex);
+  return NULL;
+}
+
+void visitWarcFiles() {
+  for (size_t i = 0; i < warcFiles.size(); i++) {
+    pthread_create(&warcFiles[i].thread, NULL, readWarcFile, &warcFiles[i]);
+  }
+  for (size_t i = 0; i < warcFiles.size(); i++) {
+    pthread_join(warcFiles[i].thread, NULL);
+  }
+}
+
+/* --listen=unix:PATH: a producer connects to the socket and sends the
+   files as records of five fields, each a 32 bit big-endian length
+   followed by that many bytes: path, mime-type, title (may be empty),
+   redirect target (empty but for redirects) and content.  All but the
+   content are up to MAX_LISTENED_FIELD_SIZE bytes long.  A record
+   with an empty path ends the stream.  The socket is only read as fast
+   as the files are added, which holds the producer back.  Links are
+   rewritten with the files received so far, so extension-less files
+   should come before the pages linking to them */
+int listenSocket = -1;
+
+static void openListenSocket() {
+  std::string socketPath = listenPath.substr(5);
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path too long: " << socketPath << std::endl;
+    exit(1);
+  }
+  strcpy(address.sun_path, socketPath.c_str());
+  unlink(socketPath.c_str());
+  listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenSocket < 0 ||
+      bind(listenSocket, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(listenSocket, 1) != 0) {
+    std::cerr << "Unable to listen on " << socketPath << ": " << strerror(errno) << std::endl;
+    exit(1);
+  }
+}
+
+static bool readListenedField(InputStream &stream, std::string &field, size_t maxSize) {
+  unsigned char length[4];
+  if (!readInputBytes(stream, (char*)length, sizeof(length))) {
+    return false;
+  }
+  size_t size = ((size_t)length[0] << 24) | (length[1] << 16) | (length[2] << 8) | length[3];
+  if (size > maxSize) {
+    std::cerr << "Invalid record from the producer: a field of " << size << " bytes, for at most " << maxSize << std::endl;
+    exit(1);
+  }
+
+  /* In chunks, so that memory only grows with the bytes received */
+  field.clear();
+  while (field.size() < size) {
+    readInputString(stream, field, std::min(size - field.size(), (size_t)LISTENED_CHUNK_SIZE));
+  }
+  return true;
+}
+
+void listenForFiles() {
+  std::string socketPath = listenPath.substr(5);
+  std::cout << "Waiting for a producer on " << socketPath << std::endl;
+  int connection = accept(listenSocket, NULL, NULL);
+  close(listenSocket);
+  unlink(socketPath.c_str());
+  InputStream stream = { socketPath, "", connection < 0 ? NULL : fdopen(connection, "rb"), 0 };
+  if (stream.file == NULL) {
+    std::cerr << "Unable to accept a connection on " << socketPath << std::endl;
+    exit(1);
+  }
+
+  std::string path;
+  std::string redirect;
+  QueuedFile file;
+  bool isEnded = false;
+  while (readListenedField(stream, path, MAX_LISTENED_FIELD_SIZE)) {
+    if (path.empty()) {
+      isEnded = true;
+      break;
+    }
+    if (!readListenedField(stream, file.mimeType, MAX_LISTENED_FIELD_SIZE) ||
+	!readListenedField(stream, file.title, MAX_LISTENED_FIELD_SIZE) ||
+	!readListenedField(stream, redirect, MAX_LISTENED_FIELD_SIZE) ||
+	!readListenedField(stream, file.payload, (size_t)-1)) {
+      break;
+    }
+    if (redirect.empty()) {
+      pushToFilenameQueue(directoryPath + "/" + path, &file);
+    } else {
+      RedirectRecord record = { path, file.title, redirect };
+      pthread_mutex_lock(&filenameQueueMutex);
+      listenedRedirects.push_back(record);
+      pthread_mutex_unlock(&filenameQueueMutex);
+    }
+  }
+  if (!isEnded) {
+    std::cerr << "The producer closed the connection before the end of the stream" << std::endl;
+    exit(1);
+  }
+  fclose(stream.file);
+  std::cout << "End of the stream on " << socketPath << std::endl;
+}
+
+/* Read the --files-from list ("-" for the standard input): relative
+   paths, each followed by a NUL, and optionally by a tab and its
+   mime-type before the NUL */
+static void readFileList() {
+  std::ifstream file;
+  if (filesFromPath != "-") {
+    file.open(filesFromPath.c_str(), std::ios::binary);
+    if (!file.is_open()) {
+      std::cerr << "Unable to open file list " << filesFromPath << std::endl;
+      exit(1);
+    }
+  }
+  std::istream &in = filesFromPath == "-" ? std::cin : file;
+
+  std::string entry;
+  while (std::getline(in, entry, '\0')) {
+    std::string path = entry.substr(0, entry.find('\t'));
+    while (path.substr(0, 2) == "./") {
+      path = path.substr(2);
+    }
+    if (path.empty()) {
+      continue;
+    }
+    if (path[0] == '/') {
+      std::cerr << "The paths of the file list must be relative to DIRECTORY: " << path << std::endl;
+      exit(1);
+    }
+    if (entry.find('\t') != std::string::npos) {
+      fileMimeTypes[path] = entry.substr(entry.find('\t') + 1);
+    }
+    listedFiles.push_back(path);
+  }
+  sortedListedFiles = listedFiles;
+  std::sort(sortedListedFiles.begin(), sortedListedFiles.end());
+  std::cout << "Read " << listedFiles.size() << " files from the file list" << std::endl;
+}
+
+void visitFileList() {
+  for (size_t i = 0; i < listedFiles.size(); i++) {
+    pushToFilenameQueue(directoryPath + "/" + listedFiles[i]);
+  }
 }
 
 void *visitDirectory(const std::string &path) {
@@ -811,10 +2933,238 @@ void *visitDirectory(const std::string &path) {
   }
 
   closedir(directory);
+  return NULL;
+}
+
+/* --order: the files of DIRECTORY go to the creator grouped by
+   namespace and mime-type, then by directory or by content, instead of
+   in readdir order, so that each cluster holds related files.  With
+   --popularity, the files it ranks come first, hottest first, so that
+   they share the first clusters.  Each is a record "GROUP \0 KEY \0
+   PATH", sorted on disk beyond the memory budget: GROUP is "0" and the
+   score for the ranked files, "1", NS and MIME-TYPE for the others */
+RecordSorter *orderedFiles = NULL;
+std::map<std::string, double> popularityScores;
+unsigned int orderedFileCount = 0;
+unsigned int popularFileCount = 0;
+
+static uint64_t mixHash(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/* MinHash of the words of a file, markup, scripts and styles left out,
+   as well as the words too short to tell a topic: their smallest hash
+   under two hash functions, in hexadecimal.  Files sharing most of
+   their vocabulary are likely to get the same one, and files on the
+   same topic often do; files without words come last */
+static std::string computeContentKey(const std::string &path) {
+  std::string sample = toLower(getFileSample(path, ORDER_SAMPLE_SIZE));
+  uint64_t minimums[2] = { (uint64_t)-1, (uint64_t)-1 };
+  size_t i = 0;
+
+  while (i < sample.size()) {
+    unsigned char character = sample[i];
+    if (character == '<') {
+      const char *ends[] = { "<script", "</script", "<style", "</style" };
+      size_t end = sample.find('>', i);
+      for (unsigned int j = 0; j < 4; j += 2) {
+	if (sample.compare(i, strlen(ends[j]), ends[j]) == 0) {
+	  /* Up to the '>' of the end tag */
+	  end = sample.find(ends[j + 1], i);
+	  if (end != std::string::npos) {
+	    end = sample.find('>', end);
+	  }
+	  break;
+	}
+      }
+      i = end == std::string::npos ? sample.size() : end + 1;
+    } else if (isalnum(character) || character >= 0x80) {
+      /* FNV-1a of the word */
+      uint64_t word = 0xcbf29ce484222325ULL;
+      size_t start = i;
+      for (; i < sample.size() && (isalnum((unsigned char)sample[i]) || (unsigned char)sample[i] >= 0x80); i++) {
+	word = (word ^ (unsigned char)sample[i]) * 0x100000001b3ULL;
+      }
+      if (i - start >= ORDER_MIN_WORD_SIZE) {
+	minimums[0] = std::min(minimums[0], mixHash(word));
+	minimums[1] = std::min(minimums[1], mixHash(word ^ 0x9e3779b97f4a7c15ULL));
+      }
+    } else {
+      i++;
+    }
+  }
+
+  char key[33];
+  snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long)minimums[0], (unsigned long long)minimums[1]);
+  return key;
+}
+
+/* Read the --popularity ranking: one file per line, its path relative
+   to DIRECTORY and its score (a number of requests, say), separated by
+   a tab */
+static void readPopularity() {
+  std::ifstream file(popularityPath.c_str());
+  if (!file.is_open()) {
+    std::cerr << "Unable to open popularity file " << popularityPath << std::endl;
+    exit(1);
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && line[line.size()-1] == '\r') {
+      line.erase(line.size()-1);
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    size_t tab = line.rfind('\t');
+    char *end = NULL;
+    double score = tab == std::string::npos ? -1 : strtod(line.c_str() + tab + 1, &end);
+    if (tab == 0 || score < 0 || end == line.c_str() + tab + 1 || *end != '\0') {
+      std::cerr << "Invalid line in " << popularityPath << ": " << line << std::endl;
+      continue;
+    }
+    std::string path = line.substr(0, tab);
+    while (path.substr(0, 2) == "./") {
+      path = path.substr(2);
+    }
+    popularityScores[path] = score;
+  }
+  std::cout << "Read " << popularityScores.size() << " scores from the popularity file" << std::endl;
+}
+
+static void addOrderedFile(const std::string &path) {
+  char key[17];
+  std::map<std::string, double>::const_iterator score = popularityScores.find(path);
+  orderedFileCount++;
+
+  /* The bits of a positive double sort as its value, their complement
+     the other way round */
+  if (score != popularityScores.end()) {
+    uint64_t bits;
+    memcpy(&bits, &score->second, sizeof(bits));
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)~bits);
+    orderedFiles->add(std::string("0") + key + '\0' + '\0' + path);
+    popularFileCount++;
+    return;
+  }
+
+  std::string mimeType = getMimeTypeForFile(path);
+  std::string group = "1" + getNamespaceForMimeType(mimeType) + mimeType;
+  if (orderName == "content" && mimeType.find("text/") == 0 && fileExists(directoryPath + "/" + path)) {
+    orderedFiles->add(group + '\0' + computeContentKey(directoryPath + "/" + path) + '\0' + path);
+  } else if (!orderName.empty()) {
+    orderedFiles->add(group + '\0' + (path.find('/') == std::string::npos ? "" : path.substr(0, path.rfind('/'))) + '\0' + path);
+  } else {
+    /* Only --popularity: the others keep coming in readdir order */
+    snprintf(key, sizeof(key), "%08x", orderedFileCount);
+    orderedFiles->add(std::string("1") + '\0' + key + '\0' + path);
+  }
+}
+
+static void orderDirectory(const std::string &path) {
+  std::string fullPath = path.empty() ? directoryPath : directoryPath + "/" + path;
+  DIR *directory = opendir(fullPath.c_str());
+  if (directory == NULL) {
+    std::cerr << "Unable to open directory " << fullPath << std::endl;
+    exit(1);
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(directory)) != NULL) {
+    std::string entryName = entry->d_name;
+    std::string relativeName = path.empty() ? entryName : path + '/' + entryName;
+
+    switch (entry->d_type) {
+    case DT_REG:
+      addOrderedFile(relativeName);
+      break;
+    case DT_DIR:
+      if (entryName != "." && entryName != "..") {
+	orderDirectory(relativeName);
+      }
+      break;
+    }
+  }
+
+  closedir(directory);
+}
+
+/* Sort the files before the visitor starts, while libmagic and the
+   mime-type cache are only used by this thread */
+static void orderFiles() {
+  double startTime = getTime();
+  size_t memoryBudget = maxMemory > 0 ? (size_t)maxMemory * 1024 * 1024 / 4 : ORDER_MEMORY_BUDGET;
+  orderedFiles = new RecordSorter(zimPath + ".order", memoryBudget);
+
+  try {
+    if (!filesFromPath.empty()) {
+      for (size_t i = 0; i < listedFiles.size(); i++) {
+	addOrderedFile(listedFiles[i]);
+      }
+    } else {
+      orderDirectory("");
+    }
+    orderedFiles->finish();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    exit(1);
+  }
+
+  std::cout << std::fixed << std::setprecision(1) << "Ordered " << orderedFileCount << " files";
+  if (!popularityPath.empty()) {
+    std::cout << ", " << popularFileCount << " of them by popularity";
+  }
+  if (!orderName.empty()) {
+    std::cout << (popularityPath.empty() ? " by " : ", the others by ") << orderName;
+  }
+  std::cout << " in " << getTime() - startTime << " s";
+  if (orderedFiles->getRunCount() > 0) {
+    std::cout << ", sorted in " << orderedFiles->getRunCount() << " runs";
+  }
+  std::cout << std::endl;
+}
+
+void visitOrderedFiles() {
+  std::string record;
+  try {
+    while (orderedFiles->next(record)) {
+      size_t keyEnd = record.find('\0', record.find('\0') + 1);
+      pushToFilenameQueue(directoryPath + "/" + record.substr(keyEnd + 1));
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    exit(1);
+  }
+  delete orderedFiles;
+  orderedFiles = NULL;
+}
+
+void visitArchive() {
+  for (size_t i = 0; i < archivePaths.size(); i++) {
+    pushToFilenameQueue(directoryPath + "/" + archivePaths[i]);
+  }
 }
 
 void *visitDirectoryPath(void *path) {
-  visitDirectory(directoryPath);
+  if (isListening) {
+    listenForFiles();
+  } else if (orderedFiles != NULL) {
+    visitOrderedFiles();
+  } else if (!filesFromPath.empty()) {
+    visitFileList();
+  } else if (isWarc) {
+    visitWarcFiles();
+  } else if (isArchive) {
+    visitArchive();
+  } else {
+    visitDirectory(directoryPath);
+  }
   std::cout << "Quitting visitor" << std::endl;
   directoryVisitorRunning(false); 
   pthread_exit(NULL);
@@ -879,13 +3229,24 @@ int main(int argc, char** argv) {
     {"description", required_argument, 0, 'd'},
     {"creator", required_argument, 0, 'c'},
     {"publisher", required_argument, 0, 'p'},
+    {"redirects", required_argument, 0, 'r'},
+    {"cache", required_argument, 0, 'C'},
+    {"listen", required_argument, 0, 'L'},
+    {"files-from", required_argument, 0, 'F'},
+    {"writer", required_argument, 0, 'W'},
+    {"threads", required_argument, 0, 'T'},
+    {"max-memory", required_argument, 0, 'M'},
+    {"compress", required_argument, 0, 'z'},
+    {"no-compress", required_argument, 0, 'Z'},
+    {"order", required_argument, 0, 'o'},
+    {"popularity", required_argument, 0, 'P'},
     {0, 0, 0, 0}
   };
   int option_index = 0;
   int c;
 
   do { 
-    c = getopt_long(argc, argv, "vw:m:f:t:d:c:l:p:", long_options, &option_index);
+    c = getopt_long(argc, argv, "vw:m:f:t:d:c:l:p:r:C:L:F:W:T:M:z:Z:o:P:", long_options, &option_index);
     
     if (c != -1) {
       switch (c) {
@@ -895,27 +3256,58 @@ int main(int argc, char** argv) {
       case 'c':
 	creator = optarg;
 	break;
+      case 'C':
+	cachePath = optarg;
+	break;
       case 'd':
 	description = optarg;
 	break;
       case 'f':
 	favicon = optarg;
 	break;
+      case 'F':
+	filesFromPath = optarg;
+	break;
       case 'l':
 	language = optarg;
 	break;
+      case 'L':
+	listenPath = optarg;
+	break;
       case 'm':
 	minChunkSize = atoi(optarg);
 	break;
+      case 'M':
+	maxMemory = atoi(optarg);
+	break;
+      case 'o':
+	orderName = optarg;
+	break;
       case 'p':
 	publisher = optarg;
 	break;
+      case 'P':
+	popularityPath = optarg;
+	break;
+      case 'r':
+	redirectsPath = optarg;
+	break;
       case 't':
 	title = optarg;
 	break;
+      case 'T':
+	threadCount = atoi(optarg);
+	break;
       case 'w':
 	welcome = optarg;
 	break;
+      case 'W':
+	writerName = optarg;
+	break;
+      case 'z':
+      case 'Z':
+	addCompressionOverrides(optarg, c == 'z');
+	break;
       }
     }
   } while (c != -1);
@@ -925,6 +3317,10 @@ int main(int argc, char** argv) {
       directoryPath = argv[optind++];
     } else if (zimPath.empty()) {
       zimPath = argv[optind++];
+    } else if (isWarcPath(directoryPath) && isWarcPath(zimPath)) {
+      /* Several WARC files, the ZIM file comes last */
+      warcPaths.push_back(zimPath);
+      zimPath = argv[optind++];
     } else {
       std::cerr << "You have too much arguments!" << std::endl;
       usage();
@@ -932,6 +3328,21 @@ int main(int argc, char** argv) {
     }
   }
   
+  /* No DIRECTORY when listening, the files are named after the socket */
+  if (!listenPath.empty()) {
+    if (listenPath.compare(0, 5, "unix:") != 0 || listenPath.size() == 5) {
+      std::cerr << "--listen only supports unix:PATH" << std::endl;
+      exit(1);
+    }
+    if (!zimPath.empty()) {
+      std::cerr << "You have too much arguments!" << std::endl;
+      usage();
+      exit(1);
+    }
+    zimPath = directoryPath;
+    directoryPath = listenPath.substr(5);
+  }
+
   if (directoryPath.empty() || zimPath.empty() || creator.empty() || publisher.empty() || description.empty() || language.empty() || welcome.empty() || favicon.empty()) {
     std::cerr << "You have too few arguments!" << std::endl;
     usage();
@@ -939,10 +3350,55 @@ int main(int argc, char** argv) {
   }
 
   /* Check arguments */
+  if (writerName != "zimlib" && writerName != "native") {
+    std::cerr << "--writer must be zimlib or native" << std::endl;
+    exit(1);
+  }
+  if (threadCount > 0 && writerName != "native") {
+    std::cerr << "--threads only applies to --writer=native" << std::endl;
+    exit(1);
+  }
+  if (maxMemory > 0 && writerName != "native" && orderName.empty() && popularityPath.empty()) {
+    std::cerr << "--max-memory only applies to --writer=native, --order and --popularity" << std::endl;
+    exit(1);
+  }
+  if (!orderName.empty() && orderName != "directory" && orderName != "content") {
+    std::cerr << "--order must be directory or content" << std::endl;
+    exit(1);
+  }
+
   if (directoryPath[directoryPath.length()-1] == '/') {
     directoryPath = directoryPath.substr(0, directoryPath.length()-1);
   }
 
+  struct stat directoryStatus;
+  if (!filesFromPath.empty() && (!listenPath.empty() || isWarcPath(directoryPath) ||
+				 stat(directoryPath.c_str(), &directoryStatus) != 0 ||
+				 !S_ISDIR(directoryStatus.st_mode))) {
+    std::cerr << "--files-from only applies to a directory" << std::endl;
+    exit(1);
+  }
+
+  if ((!orderName.empty() || !popularityPath.empty()) &&
+      (!listenPath.empty() || isWarcPath(directoryPath) ||
+       stat(directoryPath.c_str(), &directoryStatus) != 0 || !S_ISDIR(directoryStatus.st_mode))) {
+    std::cerr << "--order and --popularity only apply to a directory" << std::endl;
+    exit(1);
+  }
+
+  if (!listenPath.empty()) {
+    isArchive = true;
+    isListening = true;
+  } else if (isWarcPath(directoryPath)) {
+    isArchive = true;
+    isWarc = true;
+    warcPaths.insert(warcPaths.begin(), directoryPath);
+    indexWarcFiles();
+  } else if (stat(directoryPath.c_str(), &directoryStatus) == 0 && S_ISREG(directoryStatus.st_mode)) {
+    isArchive = true;
+    indexArchive();
+  }
+
   /* Prepare metadata */
   metadataQueue.push("Language");
   metadataQueue.push("Publisher");
@@ -953,27 +3409,129 @@ int main(int argc, char** argv) {
   metadataQueue.push("Favicon");
   metadataQueue.push("Counter");
 
-  /* Check metadata */
-  if (!fileExists(directoryPath + "/" + welcome)) {
+  if (!filesFromPath.empty()) {
+    readFileList();
+  }
+
+  if (!popularityPath.empty()) {
+    readPopularity();
+  }
+
+  if (!orderName.empty() || !popularityPath.empty()) {
+    orderFiles();
+    std::map<std::string, double>().swap(popularityScores);
+  }
+
+  /* Check metadata; the files to come from the producer aren't known
+     yet */
+  if (!isListening && !fileExists(directoryPath + "/" + welcome)) {
     std::cerr << "Unable to find welcome page " << directoryPath << "/" << welcome << std::endl;
     exit(1);
   }
 
-  if (!fileExists(directoryPath + "/" + favicon)) {
+  if (!isListening && !fileExists(directoryPath + "/" + favicon)) {
     std::cerr << "Unable to find favicon " << directoryPath << "/" << favicon << std::endl;
     exit(1);
   }
 
+  if (isListening) {
+    openListenSocket();
+  }
+
+  if (!redirectsPath.empty()) {
+    redirectsStream.open(redirectsPath.c_str());
+    if (!redirectsStream.is_open()) {
+      std::cerr << "Unable to open redirects file " << redirectsPath << std::endl;
+      exit(1);
+    }
+  }
+
+  if (!cachePath.empty()) {
+    if (cachePath[cachePath.length()-1] == '/') {
+      cachePath = cachePath.substr(0, cachePath.length()-1);
+    }
+    if (mkdir(cachePath.c_str(), 0777) != 0 && errno != EEXIST) {
+      std::cerr << "Unable to create cache directory " << cachePath << std::endl;
+      exit(1);
+    }
+    readManifest(zimPath + ".manifest");
+  }
+
   /* Directory visitor */
   directoryVisitorRunning(true);
   pthread_create(&(directoryVisitor), NULL, visitDirectoryPath, (void*)NULL);
   pthread_detach(directoryVisitor);
 
   /* ZIM creation */
+  bool isCreated = true;
   try {
-    zimCreator.create(zimPath, source);
-    zimCreator.setMinChunkSize(minChunkSize);
+    if (writerName == "native") {
+      NativeZimCreator nativeCreator;
+      nativeCreator.setMinChunkSize(minChunkSize);
+      if (threadCount > 0) {
+	nativeCreator.setThreadCount(threadCount);
+      }
+      nativeCreator.setMaxMemory((size_t)maxMemory * 1024 * 1024);
+      nativeCreator.create(zimPath, source);
+    } else {
+      zimCreator.setMinChunkSize(minChunkSize);
+      zimCreator.create(zimPath, source);
+    }
   } catch (const std::exception& e) {
     std::cerr << e.what() << std::endl;
+    isCreated = false;
+  }
+
+  if (htmlParser != NULL) {
+    gumbo_parser_destroy(htmlParser);
+  }
+  closeInputStream(archive);
+
+  /* Like a missing welcome page of a directory, but only known now */
+  if (isCreated && isListening && !fileExists(directoryPath + "/" + welcome)) {
+    std::cerr << "The producer didn't send the welcome page " << welcome << std::endl;
+    unlink(zimPath.c_str());
+    isCreated = false;
+  }
+
+  /* No manifest nor statistics for a ZIM file which wasn't written */
+  if (!isCreated) {
+    exit(1);
+  }
+
+  if (!unlistedFiles.empty()) {
+    std::cerr << unlistedFiles.size() << " files are linked to but aren't on the file list" << std::endl;
+  }
+
+  if (!cachePath.empty()) {
+    writeManifest(zimPath + ".manifest");
+    std::cout << "Incremental build: " << unchangedFileCount << " of " << manifest.size() << " files unchanged, "
+	      << cachedPayloadCount << " payloads taken from the cache" << std::endl;
+  }
+
+  /* Compression statistics */
+  if (compressedFileCount + storedFileCount > 0) {
+    std::cout << std::fixed << std::setprecision(1)
+	      << "Compression: " << compressedFileCount << " files (" << compressedFileSize / 1048576.0 << " MiB) compressed, "
+	      << storedFileCount << " files (" << storedFileSize / 1048576.0 << " MiB) stored, "
+	      << precompressedFileCount << " of them being compressed already" << std::endl;
+    if (nonTextCompressedFileCount > 0) {
+      std::cout << "Compression: " << nonTextCompressedFileCount << " files (" << nonTextCompressedFileSize / 1048576.0
+		<< " MiB) compressed which aren't text/, saving about " << nonTextSavedSize / 1048576.0
+		<< " MiB by the estimate of their samples" << std::endl;
+    }
+  }
+
+  /* Redirect stub statistics */
+  if (scannedStubCount + parsedStubCount > 0) {
+    std::cout << "Redirect stubs: " << scannedStubCount << " scanned";
+    if (scannedStubSeconds > 0) {
+      std::cout << " (" << (unsigned int)(scannedStubCount / scannedStubSeconds) << "/s)";
+    }
+    std::cout << ", " << parsedStubCount << " parsed";
+    if (parsedStubSeconds > 0) {
+      std::cout << " (" << (unsigned int)(parsedStubCount / parsedStubSeconds) << "/s)";
+    }
+    std::cout << std::endl;
   }
 }